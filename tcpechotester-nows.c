@@ -230,7 +230,7 @@ void help (void)
 	       "-n	set TCP_NODELAY option\n"
 	       "-p n	set tcp port (default %i)\n"
 	       "-a	random r/w block size (instead of max)\n"
-	       "-A	show read and written block size\n"
+	       "-A	read and write size histograms\n"
 	       "\n"
 	       "TCP client: (disables TCP SERVER)\n"
 	       "-r	repeat (close/reopen, with -s)\n"
@@ -327,6 +327,78 @@ int flushinput (int sock)
 	}
 }
 
+// -A: what read() and write() return, per direction
+struct blockstats
+{
+	long long sizes [BUFLEN + 1]; // calls per returned size
+	long long calls;  // with data
+	long long bytes;
+	long long partial; // less than asked
+	long long eagain;
+	long long zero;
+	long long icalls; // at last interval
+	long long ibytes;
+};
+struct blockstats bsr, bsw;
+
+void blockstat (struct blockstats* bs, ssize_t ret, size_t asked)
+{
+	if (ret == -1)
+	{
+		if (errno == EAGAIN)
+			bs->eagain++;
+		return;
+	}
+	if (ret == 0)
+	{
+		bs->zero++;
+		return;
+	}
+	bs->sizes[ret]++;
+	bs->calls++;
+	bs->bytes += ret;
+	if ((size_t)ret < asked)
+		bs->partial++;
+}
+
+// average size since last interval
+void blockstats_interval (struct blockstats* bs, const char* head)
+{
+	if (bs->calls > bs->icalls)
+		printf("[%s%g]", head, (bs->bytes - bs->ibytes) / (float)(bs->calls - bs->icalls));
+	bs->icalls = bs->calls;
+	bs->ibytes = bs->bytes;
+}
+
+void blockstats_show (const struct blockstats* bs, const char* name, const char* partial)
+{
+	int top = 0;
+	for (int s = 1; s <= BUFLEN; s++)
+		if (bs->sizes[s] > bs->sizes[top])
+			top = s;
+	printf("%s: %lli calls, %lli bytes, avg %g, most %i (%lli), %lli %s, %lli EAGAIN, %lli zero\n",
+		name, bs->calls, bs->bytes, bs->calls? bs->bytes / (float)bs->calls: 0, top, bs->sizes[top],
+		bs->partial, partial, bs->eagain, bs->zero);
+	for (int lo = 1; lo <= BUFLEN; lo <<= 1)
+	{
+		int hi = lo == BUFLEN? BUFLEN: 2 * lo - 1;
+		long long n = 0;
+		for (int s = lo; s <= hi; s++)
+			n += bs->sizes[s];
+		if (n)
+			printf("  %5i..%-5i %12lli\n", lo, hi, n);
+	}
+}
+
+void blockstats_summary (void)
+{
+	printf("\n");
+	if (bsr.calls || bsr.eagain || bsr.zero)
+		blockstats_show(&bsr, "read", "partial");
+	if (bsw.calls || bsw.eagain || bsw.zero)
+		blockstats_show(&bsw, "write", "short");
+}
+
 struct timeval tb, ti, te; // begin intermediary end
 long long data_in_loop = 0;
 long long data_overall = 0;
@@ -339,6 +411,11 @@ void showbw (int force)
 		printbw(te.tv_sec - tb.tv_sec, te.tv_usec - tb.tv_usec, data_overall, "avg:");
 		printbw(te.tv_sec - ti.tv_sec, te.tv_usec - ti.tv_usec, data_in_loop, "now:");
 		printsz(data_overall, "size:");
+		if (displayblocksize)
+		{
+			blockstats_interval(&bsr, "r:");
+			blockstats_interval(&bsw, "w:");
+		}
 		printf("-----"); fflush(stdout);
 		ti = te;
 		data_in_loop = 0;
@@ -390,8 +467,11 @@ void echocomparator (int sock, int datasize, ssize_t maxdiff)
 		if (pollfd.revents & POLLIN)
 		{
 			D("pollin: read");
-			ssize_t ret = dataread(sock, bufin, r(BUFLEN));
+			size_t asked = r(BUFLEN);
+			ssize_t ret = dataread(sock, bufin, asked);
 			D("%d\n", (int)ret);
+			if (displayblocksize)
+				blockstat(&bsr, ret, asked);
 			if (ret == 0)
 				// closed?
 				break;
@@ -404,8 +484,6 @@ void echocomparator (int sock, int datasize, ssize_t maxdiff)
 				perror("read");
 				exit(EXIT_FAILURE);
 			}
-			if (displayblocksize)
-				printf("%10dr\n", (int)ret);
 			ssize_t bufin_offset = 0;
 			while (ret)
 			{
@@ -473,8 +551,11 @@ void echocomparator (int sock, int datasize, ssize_t maxdiff)
 			if (size >= WRITEMIN)
 			{
 				D("write: ");
-				ssize_t ret = datawrite(sock, bufout + ptr_to_send, r(size));
+				size_t asked = r(size);
+				ssize_t ret = datawrite(sock, bufout + ptr_to_send, asked);
 				D("%d", (int)ret);
+				if (displayblocksize)
+					blockstat(&bsw, ret, asked);
 				if (ret == -1)
 				{
 #if NOWS
@@ -484,8 +565,6 @@ void echocomparator (int sock, int datasize, ssize_t maxdiff)
 					perror("write");
 					exit(EXIT_FAILURE);
 				}
-				if (displayblocksize)
-					printf("          %10dw\n", (int)ret);
 				total_sent += ret;
 				ptr_to_send = (ptr_to_send + ret) & (BUFLEN - 1);
 			}
@@ -506,6 +585,8 @@ void echocomparator (int sock, int datasize, ssize_t maxdiff)
 		tr.tv_sec += 1;
 	}
 
+	if (displayblocksize)
+		blockstats_summary();
 	my_close(sock);
 }
 
@@ -539,8 +620,11 @@ void echoresponder (int sock)
 			if (maxrecv > BUFLEN - ptr_for_recv)
 				maxrecv = BUFLEN - ptr_for_recv;
 			D("pollin: read: ");
-			ssize_t ret = dataread(sock, bufin + ptr_for_recv, r(maxrecv));
+			size_t asked = r(maxrecv);
+			ssize_t ret = dataread(sock, bufin + ptr_for_recv, asked);
 			D("%d\n", (int)ret);
+			if (displayblocksize)
+				blockstat(&bsr, ret, asked);
 			if (ret == -1)
 			{
 #if NOWS
@@ -555,8 +639,6 @@ void echoresponder (int sock)
 				fprintf(stderr, "peer has closed\n");
 				break;
 			}
-			if (displayblocksize)
-				printf("%10dr\n", (int)ret);
 			inbuf += ret;
 			ptr_for_recv = (ptr_for_recv + ret) & (BUFLEN - 1);
 		}
@@ -569,8 +651,11 @@ void echoresponder (int sock)
 			if (maxsend >= WRITEMIN)
 			{
 				D("pollin: write ");
-				ssize_t ret = datawrite(sock, bufin + ptr_to_send, r(maxsend));
+				size_t asked = r(maxsend);
+				ssize_t ret = datawrite(sock, bufin + ptr_to_send, asked);
 				D("%d\n", (int)ret);
+				if (displayblocksize)
+					blockstat(&bsw, ret, asked);
 				if (ret == -1)
 				{
 #if NOWS
@@ -580,8 +665,6 @@ void echoresponder (int sock)
 					perror("write");
 					break;
 				}
-				if (displayblocksize)
-					printf("          %10dw\n", (int)ret);
 				inbuf -= ret;
 				ptr_to_send = (ptr_to_send + ret) & (BUFLEN - 1);
 			}
@@ -595,6 +678,8 @@ void echoresponder (int sock)
 		}
 	}
 
+	if (displayblocksize)
+		blockstats_summary();
 	my_close(sock);
 }
 
@@ -617,7 +702,10 @@ void echosink (int sock)
 
 		if (pollfd.revents & POLLIN)
 		{
-			ssize_t ret = dataread(sock, bufin, r(BUFLEN));
+			size_t asked = r(BUFLEN);
+			ssize_t ret = dataread(sock, bufin, asked);
+			if (displayblocksize)
+				blockstat(&bsr, ret, asked);
 			if (ret == -1)
 			{
 #if NOWS
@@ -632,8 +720,6 @@ void echosink (int sock)
 				fprintf(stderr, "peer has closed\n");
 				break;
 			}
-			if (displayblocksize)
-				printf("%10dr\n", (int)ret);
 			data_in_loop += ret;
 			data_overall += ret;
 		}
@@ -648,6 +734,8 @@ void echosink (int sock)
 		showbw(0);
 	}
 
+	if (displayblocksize)
+		blockstats_summary();
 	my_close(sock);
 }
 
@@ -675,8 +763,11 @@ void echosource (int sock)
 		if (pollfd.revents & POLLOUT)
 		{
 			D("pollout -> write:");
-			ssize_t ret = datawrite(sock, bufout, r(BUFLEN));
+			size_t asked = r(BUFLEN);
+			ssize_t ret = datawrite(sock, bufout, asked);
 			D("%d\n", (int)ret);
+			if (displayblocksize)
+				blockstat(&bsw, ret, asked);
 			if (ret == -1)
 			{
 #if NOWS
@@ -691,8 +782,6 @@ void echosource (int sock)
 				fprintf(stderr, "peer has closed\n");
 				break;
 			}
-			if (displayblocksize)
-				printf("          %10dw\n", (int)ret);
 			data_in_loop += ret;
 			data_overall += ret;
 		}
@@ -707,6 +796,8 @@ void echosource (int sock)
 		showbw(0);
 	}
 
+	if (displayblocksize)
+		blockstats_summary();
 	my_close(sock);
 }
 
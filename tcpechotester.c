@@ -1,28 +1,76 @@
 
-// gcc -Wall -Wextra tcpechotester.c -o tcpechotester
+// gcc -O2 -Wall -Wextra -pthread tcpechotester.c -o tcpechotester -lssl -lcrypto
+
+#define _GNU_SOURCE
+
+#ifndef URING
+#define URING 1 // io_uring backend (-e uring)
+#endif
+
+#ifndef TLS
+#define TLS 1 // in-process TLS (-t tls), needs -lssl -lcrypto
+#endif
 
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/time.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
 #include <termios.h>
 #include <errno.h>
+#include <limits.h>
+#include <endian.h>
 #include <ctype.h>
 #include <assert.h>
 #include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <linux/errqueue.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#if URING
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#if TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509.h>
+#endif
 
 #define DEFAULTPORT 6969 // spin round
-#define BUFLENLOG2 10
-#define BUFLEN (1<<(BUFLENLOG2))
-static char bufout [BUFLEN];
-static char bufin [BUFLEN];
+#define DEFAULTBUFLEN (1<<10)
+#define SPLICE_PIPESZ (1<<20)
+static char* bufout; // pattern, stored twice: [ptr, ptr + buflen) is always contiguous
+static char* bufin;
+static int bufin_mirrored;
+int buflen = DEFAULTBUFLEN; // power of 2
+int hugepages = 0;
+
+enum { MODE_RESPONDER, MODE_COMPARATOR, MODE_SINK, MODE_SOURCE };
+enum { ENGINE_POLL, ENGINE_URING };
+// kernel-local transports (from TRANSPORT_UNIX) are a baseline for TCP/IP
+enum { TRANSPORT_TCP, TRANSPORT_UDP, TRANSPORT_TLS, TRANSPORT_UNIX, TRANSPORT_SEQPACKET, TRANSPORT_FIFO, TRANSPORT_PAIR, TRANSPORT_PIPE };
+int transport = TRANSPORT_TCP;
+const char* unixpath = NULL; // -t unix:path
+int engine = ENGINE_POLL;
+int zerocopy = 0;
 
 void getsetflag (int sock, int sock2, int level, int flag, int val, const char* name)
 {
@@ -82,7 +130,7 @@ int my_socket (void)
 	return sock;
 }
 
-void my_bind_listen (int srvsock,  int port)
+void my_bind_listen (int srvsock,  int port, int backlog)
 {
 	struct sockaddr_in server;
 
@@ -95,7 +143,7 @@ void my_bind_listen (int srvsock,  int port)
 		exit(EXIT_FAILURE);
 	}
 	
-	if (listen(srvsock, 1) == -1)
+	if (listen(srvsock, backlog) == -1)
 	{
 		perror("listen()");
 		exit(EXIT_FAILURE);
@@ -122,40 +170,210 @@ int my_accept (int srvsock)
 	return clisock;
 }
 
-void my_connect (const char* servername,  int port,  int sock)
+// client addresses: -d host[:port] and -i addr[:port] lists, a host brings
+// all its IPv4 addresses, connection n goes to dests[n % ndests] from
+// srcs[(n / ndests) % nsrcs]: every pair is used in turn
+#define MAXADDRS 64
+struct sockaddr_in dests [MAXADDRS];
+int ndests = 0;
+struct sockaddr_in srcs [MAXADDRS];
+int nsrcs = 0;
+static long long nconnect = 0;
+
+// append "host[:port],..." to addrs, an empty host is INADDR_ANY
+void my_resolve (const char* list, int port, struct sockaddr_in* addrs, int* naddrs)
 {
-	struct sockaddr_in server;
-	struct hostent *desc_server;
+	char* copy = strdup(list);
+	char* save;
 	
-	if ((desc_server = gethostbyname(servername)) == NULL)
+	for (char* spec = strtok_r(copy, ",", &save); spec; spec = strtok_r(NULL, ",", &save))
 	{
-		perror("gethostbyname()");
-		exit(EXIT_FAILURE);
+		int p = port;
+		char* colon = strchr(spec, ':');
+		if (colon)
+		{
+			*colon = 0;
+			p = atoi(colon + 1);
+		}
+		
+		struct addrinfo hints = { .ai_flags = AI_PASSIVE, .ai_family = AF_INET, .ai_socktype = SOCK_STREAM, };
+		struct addrinfo* res;
+		int err = getaddrinfo(*spec? spec: NULL, NULL, &hints, &res);
+		if (err)
+		{
+			fprintf(stderr, "getaddrinfo(%s): %s\n", spec, gai_strerror(err));
+			exit(EXIT_FAILURE);
+		}
+		for (struct addrinfo* ai = res; ai && *naddrs < MAXADDRS; ai = ai->ai_next)
+		{
+			addrs[*naddrs] = *(struct sockaddr_in*)ai->ai_addr;
+			addrs[*naddrs].sin_port = htons(p);
+			(*naddrs)++;
+		}
+		freeaddrinfo(res);
 	}
+	free(copy);
+}
+
+const char* my_addrstr (const struct sockaddr_in* addr)
+{
+	static char str [INET_ADDRSTRLEN + 8];
+	char ip [INET_ADDRSTRLEN];
+	inet_ntop(AF_INET, &addr->sin_addr, ip, sizeof(ip));
+	snprintf(str, sizeof(str), "%s:%i", ip, ntohs(addr->sin_port));
+	return str;
+}
+
+// next destination, sock is bound to the next source address if any,
+// returns NULL when bind() fails
+const struct sockaddr_in* my_nextaddr (int sock)
+{
+	long long n = nconnect++;
 	
-	server.sin_family = AF_INET;
-	server.sin_port = htons(port);
-	bcopy(desc_server->h_addr, &server.sin_addr, desc_server->h_length);
-	if (connect(sock, (struct sockaddr*)&server, sizeof(server)) == -1)
+	if (nsrcs)
+	{
+		const struct sockaddr_in* src = &srcs[(n / ndests) % nsrcs];
+		int one = 1;
+		// no port: chosen at connect() time, unique per 4-tuple only,
+		// a given port is shared by connections to different destinations
+		if (!src->sin_port)
+			setsockopt(sock, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+		else
+			setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (bind(sock, (const struct sockaddr*)src, sizeof(*src)) == -1)
+			return NULL;
+	}
+	return &dests[n % ndests];
+}
+
+#if TLS
+int tls_wrap (int sock, int server);
+void tls_close (int sock, long long bytes);
+extern int ktls;
+#endif
+
+// returns the fd to use (TLS: the plain end)
+int my_connect (int sock)
+{
+	int first = nconnect < ndests * (nsrcs? nsrcs: 1);
+	const struct sockaddr_in* server = my_nextaddr(sock);
+	if (!server)
+	{
+		perror("bind()");
+		exit(EXIT_FAILURE);
+	}
+	if (connect(sock, (const struct sockaddr*)server, sizeof(*server)) == -1)
 	{
 		perror("connect()");
 		exit(EXIT_FAILURE);
 	}
 	
-	static int displayed = 0;
-	if (!displayed)
+	// each address pair is displayed once
+	if (first)
 	{
-		displayed = 1;
-		printf("connected to %s.\n", servername);
+		struct sockaddr_in local;
+		socklen_t len = sizeof(local);
+		printf("connected to %s", my_addrstr(server));
+		if (getsockname(sock, (struct sockaddr*)&local, &len) == 0)
+			printf(" from %s", my_addrstr(&local));
+		printf(".\n");
 	}
+	
+#if TLS
+	if (transport == TRANSPORT_TLS)
+		return tls_wrap(sock, 0);
+#endif
+	return sock;
 }
 
-void my_close (int sock)
+// bytes: moved both ways by the loop, for -t ktls
+void my_close (int sock, long long bytes)
 {
+#if TLS
+	if (ktls && sock >= 0)
+		tls_close(sock, bytes);
+#else
+	(void)bytes;
+#endif
 	if (sock >= 0)
 		close(sock);
 }
 
+int my_unix_socket (void)
+{
+	int sock;
+	if ((sock = socket(AF_UNIX, transport == TRANSPORT_SEQPACKET? SOCK_SEQPACKET: SOCK_STREAM, 0)) == -1)
+	{
+		perror("socket()");
+		exit(EXIT_FAILURE);
+	}
+	return sock;
+}
+
+static void my_unix_addr (struct sockaddr_un* addr, const char* path)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path))
+	{
+		fprintf(stderr, "socket path too long: '%s'\n", path);
+		exit(EXIT_FAILURE);
+	}
+	strcpy(addr->sun_path, path);
+}
+
+void my_unix_bind_listen (int srvsock, const char* path, int backlog)
+{
+	struct sockaddr_un server;
+	
+	my_unix_addr(&server, path);
+	unlink(path);
+	if (bind(srvsock, (struct sockaddr*)&server, sizeof(server)) == -1)
+	{
+		perror("bind()");
+		exit(EXIT_FAILURE);
+	}
+	
+	if (listen(srvsock, backlog) == -1)
+	{
+		perror("listen()");
+		exit(EXIT_FAILURE);
+	}
+	
+	printf("bind & listen done.\n");
+}
+
+void my_unix_connect (const char* path, int sock)
+{
+	struct sockaddr_un server;
+	
+	my_unix_addr(&server, path);
+	if (connect(sock, (struct sockaddr*)&server, sizeof(server)) == -1)
+	{
+		perror("connect()");
+		exit(EXIT_FAILURE);
+	}
+	printf("connected to %s.\n", path);
+}
+
+// fifo end, created if needed, blocks until the other end is opened
+int my_fifo_open (const char* path, int flags)
+{
+	int fd;
+	if (mkfifo(path, 0600) == -1 && errno != EEXIST)
+	{
+		perror("mkfifo()");
+		exit(EXIT_FAILURE);
+	}
+	if ((fd = open(path, flags)) == -1)
+	{
+		perror("open()");
+		exit(EXIT_FAILURE);
+	}
+	printf("%s opened.\n", path);
+	return fd;
+}
+
 void help (void)
 {
 	printf("** TCP echo tester - options are:\n"
@@ -169,36 +387,106 @@ void help (void)
 	       "Comparator specifics:\n"
 	       "-c n	use this char instead of random data\n"
 	       "-c -1	increasing data from 0\n"
+	       "-c -3	offset-keyed data, never repeating (not with -z)\n"
+	       "-k key	same with this key: -S and -K elsewhere generate and verify it\n"
 	       "-s n	size (instead of infinite)\n"
 	       "-s -n	random size in [1..n]\n"
 	       "-w n	pause output to ensure sizesent-sizerecv < n\n"
+	       "-P n	n parallel connections (TCP client)\n"
+	       "-L	echo latency histogram\n"
+	       "-x n	connect/request/close n times (0: forever, -P in flight)\n"
+	       "-q n,m	request/response: send n bytes, wait for m bytes back\n"
+	       "	(responder: reply m bytes per n received, default m=n)\n"
+	       "\n"
+	       "Buffers:\n"
+	       "-l n	buffer size, k/m/g suffix (default %i, rounded to power of 2)\n"
+	       "-H	hugepage-backed rings (with -l 2m or more)\n"
+	       "\n"
+	       "Zero-copy:\n"
+	       "-z	responder: echo through a pipe with splice()\n"
+	       "	source, comparator (TCP client): MSG_ZEROCOPY sends\n"
+	       "	sink: TCP_ZEROCOPY_RECEIVE (mmap'ed receive queue)\n"
 	       "\n"
 	       "Serial:\n"
 	       "-y tty	use tty device\n"
-	       "-b baud	for tty device\n"
-	       "-m 8n1	for tty device\n"
+	       "-y pty	self-loopback: -C or -S on a new pty, forked -R or -K on its master\n"
+	       "-b baud	for tty device, any rate (termios2), applied rate is shown\n"
+	       "-m 8n1[r|x]	for tty device, r: RTS/CTS, x: XON/XOFF\n"
+	       "-u	low latency tty (ASYNC_LOW_LATENCY)\n"
+	       "-U ms	USB-serial latency timer (ftdi_sio...)\n"
+	       "-V min[,ms]	batch tty reads: min chars (VMIN) or ms elapsed (default 10)\n"
 	       "\n"
 	       "TCP:\n"
 	       "-n	set TCP_NODELAY option\n"
+#if URING
+	       "-e uring	io_uring backend (TCP client, default: poll)\n"
+#endif
+	       "\n"
+	       "UDP:\n"
+	       "-t udp	UDP transport (default: tcp), -R/-K bind -p, -C/-S need -d\n"
+	       "-g n	datagram size (default 1024, 16-byte sequence/time header)\n"
+	       "-B rate	send rate in bits/s, k/m/g suffix (default: unlimited)\n"
+	       "\n"
+	       "Local transports: (kernel only baseline, no -d)\n"
+	       "-t unix[:path]	unix stream socket (default /tmp/tcpechotester.sock)\n"
+	       "-t seqpacket[:path]	unix seqpacket socket, same -l on both sides\n"
+	       "	-R/-K listen (many clients), -C/-S connect\n"
+	       "-t fifo[:path]	-S writes, -K reads (default /tmp/tcpechotester.fifo)\n"
+	       "-t pair	socketpair, -C or -S with a forked -R or -K\n"
+	       "-t pipe	pipe, -S with a forked -K\n"
+	       "\n"
+	       "TCP server: (all modes, many clients)\n"
+	       "-T n	n threads (SO_REUSEPORT listeners)\n"
+	       "-J	pin threads to cpus\n"
 	       "\n"
 	       "TCP client:\n"
 	       "-r      repeat (close/reopen, with -s)\n"
 	       "-d host	set tcp remote host name\n"
+	       "-d host[:port],...	several hosts (or -d again): all their addresses,\n"
+	       "	-P, -r and -x connections go round robin\n"
+	       "-i addr[:port],...	bind to local source addresses (round robin too)\n"
 	       "-p n	set tcp port (default %i)\n"
 	       "(otherwise act as TCP server if no Serial)\n"
 	       "\n"
-	       "SSL/TLS client:\n"
+#if TLS
+	       "SSL/TLS: (in-process, client and server, all modes)\n"
+	       "-t tls	TLS over TCP, handshakes are timed apart from throughput,\n"
+	       "	sessions are resumed by next connections (-r, -P)\n"
+	       "-t ktls	same, records by the kernel when it accepts the keys\n"
+	       "-M version	TLS1, TLS1.1, TLS1.2 or TLS1.3 (default: negotiated)\n"
+	       "-X cert[,key]	server certificate, PEM (default: self-signed)\n"
+	       "\n"
+#endif
+	       "SSL/TLS client without -t tls:\n"
 	       "\tfork/use external socat tool\n"
 	       "\toption -r will also kill/restart socat)\n"
 	       "\tconflicts with -y\n"
 	       "\tneeds -d\n"
 	       "-M method (socat's methods, like TLS1.2,...)\n"
-	       "\n", DEFAULTPORT);
+	       "\n"
+	       "Statistics are displayed every second,\n"
+	       "SIGUSR1 (kill -USR1 pid) prints and keeps a line on demand.\n"
+	       "-o fmt	text (default), json (lines) or csv records\n"
+	       "\n", DEFAULTBUFLEN, DEFAULTPORT);
+}
+
+// size with optional k/m/g suffix
+long long parsesize (const char* str)
+{
+	char* end;
+	long long size = strtoll(str, &end, 0);
+	switch (tolower(*end))
+	{
+	case 'g': size <<= 10; // fall through
+	case 'm': size <<= 10; // fall through
+	case 'k': size <<= 10;
+	}
+	return size;
 }
 
-long long bwbps (int diff_s, int diff_us, long long size)
+long long bwbps (long long ns, long long size)
 {
-	return size / (diff_s + 0.000001 * diff_us) * 8.0;
+	return ns > 0? size * 8e9 / ns: 0;
 }
 
 char eng (float* v)
@@ -213,9 +501,9 @@ char eng (float* v)
 	return unit[unitp];
 }
 
-void printbw (int diff_s, int diff_us, long long size, const char* head)
+void printbw (long long ns, long long size, const char* head)
 {
-	float bw = bwbps(diff_s, diff_us, size);
+	float bw = bwbps(ns, size);
 	char u = eng(&bw);
 	printf("[%s%g %cibps]", head?:"", bw, u);
 }
@@ -274,328 +562,4336 @@ int flushinput (int sock)
 	}
 }
 
-struct timeval tb, ti, te; // begin intermediary end
+// statistics: hot loops only count, times are CLOCK_MONOTONIC ns,
+// reports are driven by statfd (1s timerfd tick, SIGUSR1 for a snapshot)
+long long tb, ti, te; // begin intermediary end
 long long data_in_loop = 0;
 long long data_overall = 0;
+int statfd = -1;
+static int stat_timer = -1;
+static int stat_signal = -1;
+static int stat_snapshot = 0;
 
-void showbw (int force)
+long long nowns (void)
 {
-	if (force || te.tv_sec - ti.tv_sec > 1)
-	{
-		printf("\r");
-		printbw(te.tv_sec - tb.tv_sec, te.tv_usec - tb.tv_usec, data_overall, "avg:");
-		printbw(te.tv_sec - ti.tv_sec, te.tv_usec - ti.tv_usec, data_in_loop, "now:");
-		printsz(data_overall, "size:");
-		printf("-----"); fflush(stdout);
-		ti = te;
-		data_in_loop = 0;
-	}
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000LL + t.tv_nsec;
 }
 
-void echocomparator (int sock, int datasize, ssize_t maxdiff)
+// before any thread is created: SIGUSR1 is blocked everywhere, read from stat_signal
+void stat_init (void)
 {
-	// bufout is already filled and not modified
-	// send bufout again and again
-	// verify bufin receives same data at same (offset mod bufsize)
-	
-	setcntl(sock, F_SETFL, O_NONBLOCK, "O_NONBLOCK");
+	sigset_t set;
+	struct itimerspec tick = { .it_interval = { 1, 0 }, .it_value = { 1, 0 }, };
 	
-	long long total_sent = 0, total_recvd = 0;
-	int ptr_to_send = 0;
-	int ptr_for_bufout_compare = 0;
-	struct pollfd pollfd;
-	static struct timeval tr;
-	static long long loop_count = 0;
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
 	
-	if (datasize < 0)
-		datasize = (random() % -datasize) + 1;
+	if (   (stat_signal = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC)) == -1
+	    || (stat_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1
+	    || timerfd_settime(stat_timer, 0, &tick, NULL) == -1
+	    || (statfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+	{
+		perror("stat_init");
+		exit(EXIT_FAILURE);
+	}
 	
-	if (!data_overall)
+	struct epoll_event ev = { .events = EPOLLIN, };
+	if (   epoll_ctl(statfd, EPOLL_CTL_ADD, stat_timer, &ev) == -1
+	    || epoll_ctl(statfd, EPOLL_CTL_ADD, stat_signal, &ev) == -1)
 	{
-		gettimeofday(&tb, NULL);
-		ti = tb;
-		tr = tb;
+		perror("epoll_ctl");
+		exit(EXIT_FAILURE);
 	}
+}
+
+// statfd is readable, returns 1 when a report is due (te is set)
+int stat_tick (void)
+{
+	uint64_t ticks;
+	struct signalfd_siginfo si;
 	
-	int cont = 1;
-	pollfd.fd = sock;
-	while (cont)
+	int due = read(stat_timer, &ticks, sizeof(ticks)) == sizeof(ticks);
+	while (read(stat_signal, &si, sizeof(si)) == sizeof(si))
+		due = stat_snapshot = 1;
+	if (due)
+		te = nowns();
+	return due;
+}
+
+// end of a report line: a snapshot stays on screen
+void stat_endline (void)
+{
+	if (stat_snapshot)
 	{
-		pollfd.events = POLLIN;
-		if (!maxdiff || total_recvd > total_sent - maxdiff)
-			pollfd.events |= POLLOUT;
-		int ret = poll(&pollfd, 1, 1000 /*ms*/);
-		
-		if (ret == -1)
-		{
-			perror("poll");
-			exit(EXIT_FAILURE);
-		}
+		printf("\n");
+		stat_snapshot = 0;
+	}
+	fflush(stdout);
+}
 
-		if (pollfd.revents & POLLIN)
-		{
-			ssize_t ret = read(sock, bufin, BUFLEN);
-			if (ret == 0)
-				// closed?
-				break;
-			if (ret == -1)
-			{
-				perror("read");
-				exit(EXIT_FAILURE);
-			}
-			ssize_t bufin_offset = 0;
-			while (ret)
-			{
-				ssize_t size = ret;
-				if (size > BUFLEN - ptr_for_bufout_compare)
-					size = BUFLEN - ptr_for_bufout_compare;
-				if (memcmp(bufin + bufin_offset, bufout + ptr_for_bufout_compare, size) != 0)
-				{
-					fprintf(stderr, "\ndata differ (sent=%lli revcd=%lli ptrsend=%i ptr_for_bufout_compare=%i tocheck=%i)\n",
-						total_sent,
-						total_recvd,
-						ptr_to_send,
-						ptr_for_bufout_compare,
-						(int)ret);
-					int i;
-					for (i = 0; i < size; i++)
-						if (bufin[i + bufin_offset] != bufout[i + ptr_for_bufout_compare])
-						{
-							printf("offset-diff @%lli @0x%llx\n", i + total_recvd, i + total_recvd);
-							break;
-						}
-					#define SHOW 16
-					// difference is at bufin[i + bufin_offset] and bufout[i + ptr_for_bufout_compare]
-					// show SHOW before
-					ssize_t start = i - SHOW;
-					for (ssize_t j = start + BUFLEN; j < i + BUFLEN; j++)
-					{
-						unsigned char c = bufout[(j + ptr_for_bufout_compare) & (BUFLEN - 1)];
-						printf("@%llx:R%02x(%c)/S%02x(%c)\n",
-							j + total_recvd - BUFLEN,
-							c, c>31?c:'.',
-							c, c>31?c:'.');
-					}
-					// show SHOW after
-					for (ssize_t j = i; j < i + SHOW && j + bufin_offset < size; j++)
-					{
-						unsigned char c = (uint8_t)bufin[j + bufin_offset];
-						unsigned char d = (uint8_t)bufout[(j + ptr_for_bufout_compare) & (BUFLEN - 1)];
-						printf("@%llx:R%02x(%c)/S%02x(%c) (diff)\n",
-							j + total_recvd,
-							c, c>31?c:'.',
-							d, d>31?d:'.');
-					}
-					printf("\n");
-					
-					exit(EXIT_FAILURE);
-				}
-				total_recvd += size;
-				data_overall += size;
-				data_in_loop += size;
-				ptr_for_bufout_compare = (ptr_for_bufout_compare + size) & (BUFLEN - 1);
-				ret -= size;
-				bufin_offset += size;
-			}
-		}
-		
-		if (pollfd.revents & POLLOUT)
+// MSG_ZEROCOPY transmit (-z with -S/-C):
+// sends come from a large pinned region holding bufout's pattern,
+// which is never modified, completions are reaped from the error queue
+
+#define ZC_REGION (1<<22) // power of 2
+
+struct zcstats
+{
+	long long sends;
+	long long completed; // sends (or bytes with -K)
+	long long copied;    // sends (or bytes with -K)
+};
+
+struct zcstats zcstats;
+static char* zcregion = NULL;
+static int zclen; // ZC_REGION or buflen
+
+char* zc_region (void)
+{
+	if (!zcregion)
+	{
+		// pattern stored twice like bufout
+		zclen = buflen > ZC_REGION? buflen: ZC_REGION;
+		zcregion = (char*)mmap(NULL, 2 * (size_t)zclen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+		if (zcregion == MAP_FAILED)
 		{
-			ssize_t size = BUFLEN - ptr_to_send;
-			if (datasize && (total_sent + size > datasize))
-				size = datasize - total_sent;
-			if (maxdiff && size > (total_recvd - total_sent + maxdiff))
-				size = total_recvd - total_sent + maxdiff;
-			if (size)
-			{
-				ssize_t ret = write(sock, bufout + ptr_to_send, size);
-				if (ret == -1)
-				{
-					perror("write");
-					exit(EXIT_FAILURE);
-				}
-				total_sent += ret;
-				ptr_to_send = (ptr_to_send + ret) & (BUFLEN - 1);
-			}
+			perror("mmap(zerocopy region)");
+			exit(EXIT_FAILURE);
 		}
-
-		gettimeofday(&te, NULL);
-		cont = !datasize || datasize > total_sent || datasize > total_recvd;
-		if (te.tv_sec >= tr.tv_sec)
-			showbw(!cont);
+		for (size_t i = 0; i < 2 * (size_t)zclen; i += buflen)
+			memcpy(zcregion + i, bufout, buflen);
+		if (mlock(zcregion, 2 * (size_t)zclen) == -1)
+			perror("mlock(zerocopy region)");
 	}
+	return zcregion;
+}
 
-	++loop_count;	
-	if (te.tv_sec >= tr.tv_sec)
+// returns 0 when zero-copy sends are not possible on sock
+int zc_enable (int sock)
+{
+	int one = 1;
+	if (setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == -1)
 	{
-		fprintf(stderr, "  send&received %lli / %lli bytes (=%i) -- (#%lld)          \r", total_sent, data_overall, datasize, loop_count);
-		tr.tv_sec += 1;
+		fprintf(stderr, "SO_ZEROCOPY: %s - copying\n", strerror(errno));
+		return 0;
 	}
-
-	my_close(sock);
+	return 1;
 }
 
-void echoresponder (int sock)
+// collect send completions from the socket error queue
+void zc_reap (int sock)
 {
-	setcntl(sock, F_SETFL, O_NONBLOCK, "O_NONBLOCK");
-	
-	int ptr_to_send = 0;
-	int ptr_for_recv = 0;
-	size_t inbuf = 0;
-	struct pollfd pollfd = { .fd = sock, .events = POLLIN | POLLOUT, };
-	
 	while (1)
 	{
-		pollfd.events =  0;
-		if (inbuf < BUFLEN) pollfd.events |= POLLIN;
-		if (inbuf) pollfd.events |= POLLOUT;
-		int ret = poll(&pollfd, 1, 1000 /*ms*/);
-		if (ret == -1)
-		{
-			perror("poll");
-			close(sock);
-			return;
-		}
-
-		if (pollfd.revents & POLLIN)
-		{
-			ssize_t maxrecv = BUFLEN - inbuf;
-			if (maxrecv > BUFLEN - ptr_for_recv)
-				maxrecv = BUFLEN - ptr_for_recv;
-			ssize_t ret = read(sock, bufin + ptr_for_recv, maxrecv);
-			if (ret == -1)
-			{
-				perror("read");
-				break;
-			}
-			if (ret == 0)
-			{
-				fprintf(stderr, "peer has closed\n");
-				break;
-			}
-			inbuf += ret;
-			ptr_for_recv = (ptr_for_recv + ret) & (BUFLEN - 1);
-		}
+		char control [CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+		struct msghdr msg = { .msg_control = control, .msg_controllen = sizeof(control), };
 		
-		if (pollfd.revents & POLLOUT)
+		if (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
 		{
-			ssize_t maxsend = inbuf;
-			if (maxsend > BUFLEN - ptr_to_send)
-				maxsend = BUFLEN - ptr_to_send;
-			ssize_t ret = write(sock, bufin + ptr_to_send, maxsend);
-			if (ret == -1)
-			{
-				perror("write");
-				break;
-			}
-			inbuf -= ret;
-			ptr_to_send = (ptr_to_send + ret) & (BUFLEN - 1);
+			if (errno != EAGAIN)
+				perror("recvmsg(MSG_ERRQUEUE)");
+			return;
 		}
 		
-		if (pollfd.revents & ~(POLLIN | POLLOUT))
+		for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
 		{
-			fprintf(stderr, "unregular event occured\n");
-			break;
+			struct sock_extended_err* serr = (struct sock_extended_err*)CMSG_DATA(cm);
+			if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+			// notification covers sends #ee_info to #ee_data
+			long long n = serr->ee_data - serr->ee_info + 1;
+			zcstats.completed += n;
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				zcstats.copied += n;
 		}
 	}
+}
 
-	my_close(sock);
+// user + system seconds
+double cputime (void)
+{
+	struct rusage ru;
+	if (getrusage(RUSAGE_SELF, &ru) == -1)
+		return 0;
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + 0.000001 * (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
 }
 
-void echosink (int sock)
+void printcpu (long long size, const char* head)
 {
-	struct pollfd pollfd = { .fd = sock, .events = POLLIN, };
-	
-	gettimeofday(&tb, NULL);
-	ti = tb;
+	if (!size)
+		return;
+	printf("[%s%g s/GiB]", head?:"", cputime() / size * (1<<30));
+}
 
-	while (1)
+void zc_summary (void)
+{
+	printf("zerocopy: %lli sends, %lli completed, %lli without copy, %lli copied ",
+		zcstats.sends,
+		zcstats.completed,
+		zcstats.completed - zcstats.copied,
+		zcstats.copied);
+	printcpu(data_overall, "cpu:");
+	printf("\n");
+}
+
+// TCP_ZEROCOPY_RECEIVE (-z with -K):
+// whole payload pages of the receive queue are mapped instead of copied,
+// what is not mappable (partial pages) is read()
+
+#define ZCRX_LEN (1<<21) // multiple of page size
+
+struct zcrx
+{
+	char* addr;
+	long long mapped;
+	long long copied;
+};
+
+// returns 0 when the socket cannot be mapped
+int zcrx_init (struct zcrx* z, int sock)
+{
+	z->addr = (char*)mmap(NULL, ZCRX_LEN, PROT_READ, MAP_SHARED, sock, 0);
+	if (z->addr == MAP_FAILED)
 	{
-		int ret = poll(&pollfd, 1, 1000 /*ms*/);
-		if (ret == -1)
-		{
-			perror("poll");
-			close(sock);
-			return;
-		}
+		fprintf(stderr, "mmap(socket): %s - copying\n", strerror(errno));
+		return 0;
+	}
+	z->mapped = 0;
+	z->copied = 0;
+	return 1;
+}
 
-		if (pollfd.revents & POLLIN)
-		{
-			ssize_t ret = read(sock, bufin, BUFLEN);
-			if (ret == -1)
-			{
+void zcrx_close (struct zcrx* z)
+{
+	munmap(z->addr, ZCRX_LEN);
+}
+
+// returns the number of bytes received (mapped + copied),
+// 0 when peer has closed, -1 on error
+ssize_t zcrx_recv (int sock, struct zcrx* z, char* copybuf, size_t copylen)
+{
+	// previous mapping is replaced
+	struct tcp_zerocopy_receive zc = { .address = (uintptr_t)z->addr, .length = ZCRX_LEN, };
+	socklen_t zclen = sizeof(zc);
+	if (getsockopt(sock, IPPROTO_TCP, TCP_ZEROCOPY_RECEIVE, &zc, &zclen) == -1)
+		return -1;
+	
+	ssize_t got = zc.length;
+	z->mapped += zc.length;
+	if (zc.recv_skip_hint || !zc.length)
+	{
+		// remainder is copied
+		size_t len = copylen;
+		if (zc.recv_skip_hint && zc.recv_skip_hint < len)
+			len = zc.recv_skip_hint;
+		ssize_t ret = read(sock, copybuf, len);
+		if (ret <= 0)
+			return got? got: ret;
+		z->copied += ret;
+		got += ret;
+	}
+	return got;
+}
+
+void zcrx_summary (const struct zcrx* z)
+{
+	printf("zerocopy receive: ");
+	printsz(z->mapped, "mapped:");
+	printsz(z->copied, "copied:");
+	if (z->mapped + z->copied)
+		printf("[%lli%% without copy]", 100 * z->mapped / (z->mapped + z->copied));
+	printcpu(z->mapped + z->copied, "cpu:");
+	printf("\n");
+}
+
+// log-bucketed histogram (HDR-style): values below 2*HIST_SUB are exact,
+// above, each power of 2 is split in HIST_SUB linear sub-buckets (~3%)
+
+#define HIST_SUB 32
+#define HIST_BUCKETS (2 * HIST_SUB + 57 * HIST_SUB)
+
+struct hist
+{
+	long long count;
+	long long max;
+	long long buckets [HIST_BUCKETS];
+};
+
+static int hist_index (long long v)
+{
+	if (v < 2 * HIST_SUB)
+		return v < 0? 0: v;
+	int shift = 63 - __builtin_clzll(v) - 5; // v >> shift is in [HIST_SUB, 2*HIST_SUB)
+	return 2 * HIST_SUB + (shift - 1) * HIST_SUB + (int)(v >> shift) - HIST_SUB;
+}
+
+// middle of bucket
+static long long hist_value (int idx)
+{
+	if (idx < 2 * HIST_SUB)
+		return idx;
+	int k = idx - 2 * HIST_SUB;
+	int shift = k / HIST_SUB + 1;
+	return ((long long)(k % HIST_SUB + HIST_SUB) << shift) + (1LL << (shift - 1));
+}
+
+void hist_add (struct hist* h, long long v)
+{
+	h->buckets[hist_index(v)]++;
+	h->count++;
+	if (v > h->max)
+		h->max = v;
+}
+
+void hist_reset (struct hist* h)
+{
+	memset(h, 0, sizeof(*h));
+}
+
+long long hist_quantile (const struct hist* h, double q)
+{
+	long long target = q * h->count + 0.5;
+	long long sum = 0;
+	if (target < 1)
+		target = 1;
+	for (int i = 0; i < HIST_BUCKETS; i++)
+		if ((sum += h->buckets[i]) >= target)
+			return hist_value(i) < h->max? hist_value(i): h->max;
+	return h->max;
+}
+
+void printns (long long ns, const char* head)
+{
+	if (ns < 10000)
+		printf("[%s%llins]", head?:"", ns);
+	else if (ns < 10000000)
+		printf("[%s%gus]", head?:"", ns / 1000.0);
+	else
+		printf("[%s%gms]", head?:"", ns / 1000000.0);
+}
+
+void printhist (const struct hist* h)
+{
+	printns(hist_quantile(h, 0.5), "p50:");
+	printns(hist_quantile(h, 0.99), "p99:");
+	printns(hist_quantile(h, 0.999), "p99.9:");
+	printns(h->max, "max:");
+}
+
+// comparator echo latency (-L):
+// send time of each chunk is kept until the chunk's last byte is back
+int latency = 0;
+struct hist lat_interval;
+struct hist lat_overall;
+
+struct latsample
+{
+	long long end; // stream offset after chunk
+	long long t;   // ns
+};
+
+void lat_summary (void)
+{
+	printf("echo latency: %lli samples ", lat_overall.count);
+	printhist(&lat_overall);
+	printf("\n");
+}
+
+// request/response (-q n,m)
+int rr_req = 0;
+int rr_resp = 0;
+long long rr_trans = 0;
+
+// structured output (-o json|csv): one record per interval, and a summary,
+// with exact counters and CLOCK_MONOTONIC ns timestamps
+enum { OUTPUT_TEXT, OUTPUT_JSON, OUTPUT_CSV };
+int output = OUTPUT_TEXT;
+const char* stat_mode = "";
+char stat_peer [256] = "";
+FILE* stat_out; // records, the original stdout (human text goes to stderr)
+
+// JSON string
+void stat_string (const char* str)
+{
+	fputc('"', stat_out);
+	for (; *str; str++)
+	{
+		if (*str == '"' || *str == '\\')
+			fprintf(stat_out, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			fprintf(stat_out, "\\u%04x", *str);
+		else
+			fputc(*str, stat_out);
+	}
+	fputc('"', stat_out);
+}
+
+// CSV field, quoted when needed (-d host,host)
+void stat_field (const char* str)
+{
+	if (!strpbrk(str, ",\"\r\n"))
+	{
+		fputs(str, stat_out);
+		return;
+	}
+	fputc('"', stat_out);
+	for (; *str; str++)
+	{
+		if (*str == '"')
+			fputc('"', stat_out);
+		fputc(*str, stat_out);
+	}
+	fputc('"', stat_out);
+}
+
+struct record
+{
+	const char* type; // interval, stream, summary...
+	int stream;       // -1: all
+	long long interval; // ns
+	long long bytes;
+	long long total_bytes;
+	long long count;       // transactions, connections
+	long long total_count;
+	long long failed;
+	const struct hist* lat;
+	double cpu; // s
+};
+
+void stat_record (const struct record* r)
+{
+	static int header = 0;
+	long long bps = bwbps(r->interval, r->bytes);
+	long long p50 = 0, p99 = 0, p999 = 0, max = 0;
+	
+	if (r->lat && r->lat->count)
+	{
+		p50 = hist_quantile(r->lat, 0.5);
+		p99 = hist_quantile(r->lat, 0.99);
+		p999 = hist_quantile(r->lat, 0.999);
+		max = r->lat->max;
+	}
+	
+	if (output == OUTPUT_CSV)
+	{
+		if (!header)
+		{
+			header = 1;
+			fprintf(stat_out, "type,time_ns,elapsed_ns,interval_ns,mode,peer,buflen,stream,bytes,total_bytes,bps,count,total_count,failed,p50_ns,p99_ns,p999_ns,max_ns,cpu_s\n");
+		}
+		fprintf(stat_out, "%s,%lli,%lli,%lli,%s,", r->type, te, te - tb, r->interval, stat_mode);
+		stat_field(stat_peer);
+		fprintf(stat_out, ",%i,%i,%lli,%lli,%lli,%lli,%lli,%lli,%lli,%lli,%lli,%lli,%g\n",
+			buflen, r->stream,
+			r->bytes, r->total_bytes, bps, r->count, r->total_count, r->failed, p50, p99, p999, max, r->cpu);
+	}
+	else
+	{
+		fprintf(stat_out, "{\"type\":\"%s\",\"time_ns\":%lli,\"elapsed_ns\":%lli,\"interval_ns\":%lli,"
+		       "\"mode\":\"%s\",\"peer\":",
+			r->type, te, te - tb, r->interval, stat_mode);
+		stat_string(stat_peer);
+		fprintf(stat_out, ",\"buflen\":%i,\"stream\":%i,\"bytes\":%lli,\"total_bytes\":%lli,\"bps\":%lli",
+			buflen, r->stream, r->bytes, r->total_bytes, bps);
+		if (r->count || r->total_count)
+			fprintf(stat_out, ",\"count\":%lli,\"total_count\":%lli", r->count, r->total_count);
+		if (r->failed)
+			fprintf(stat_out, ",\"failed\":%lli", r->failed);
+		if (r->lat && r->lat->count)
+			fprintf(stat_out, ",\"samples\":%lli,\"p50_ns\":%lli,\"p99_ns\":%lli,\"p999_ns\":%lli,\"max_ns\":%lli", r->lat->count, p50, p99, p999, max);
+		if (r->cpu)
+			fprintf(stat_out, ",\"cpu_s\":%g", r->cpu);
+		fprintf(stat_out, "}\n");
+	}
+	fflush(stat_out);
+}
+
+// end of a client run
+void stat_summary (void)
+{
+	stat_record(&(struct record){ .type = "summary", .stream = -1, .interval = te - tb,
+		.bytes = data_overall, .total_bytes = data_overall,
+		.count = rr_trans, .total_count = rr_trans, .lat = &lat_overall, });
+}
+
+#if TLS
+// in-process TLS (-t tls): after the handshake, a thread per connection moves
+// data between the TLS socket and a socketpair, loops use the other end
+// unchanged, and throughput excludes handshakes
+
+#define TLS_BUF (1<<16)
+#define TLS_ACCEPT_TIMEOUT 10 // s, server handshake
+#define TLS_TICKET_WAIT 200   // ms, client, before -P streams
+
+// -t ktls: records are done by the kernel when it accepts the keys
+// (TCP_ULP "tls", TLS_TX, TLS_RX), then the loops read and write the socket
+enum { TLS_USER, TLS_KTLS_TX, TLS_KTLS_RX, TLS_KTLS_TXRX };
+static const char* tls_pathname [] = { "user-space", "kTLS tx, user-space rx", "kTLS rx, user-space tx", "kTLS tx+rx", };
+static const char* tls_pathtype [] = { "tls_user", "tls_ktls_tx", "tls_ktls_rx", "tls_ktls_txrx", };
+int ktls = 0;
+long long tls_paths [4]; // connections
+long long tls_bytes [4]; // application data, both ways
+double tls_cpu [4];      // pump threads, s
+int tls_pumps = 0;       // running
+
+const char* tls_version = NULL; // -M with -t tls
+const char* tls_cert = NULL;    // -X cert.pem[,key.pem]
+static SSL_CTX* tls_ctx;
+static SSL_SESSION* tls_session; // client, resumed by the next connection
+static pthread_mutex_t tls_lock = PTHREAD_MUTEX_INITIALIZER;
+struct hist tls_handshake;       // client, ns
+long long tls_resumed = 0;
+int tls_every = 0;      // client: a line per handshake (-r)
+int tls_ticketwait = 0; // client: the next connections are opened at once (-P)
+
+struct tls_pump
+{
+	SSL* ssl;
+	int sock;  // TCP
+	int plain; // our socketpair end
+	char down [TLS_BUF]; // TLS to plain
+	size_t downoff, downlen;
+	char up [TLS_BUF];   // plain to TLS
+	size_t upoff, uplen;
+	int path;
+	long long bytes;
+};
+
+static void tls_fail (const char* what)
+{
+	fprintf(stderr, "%s:\n", what);
+	ERR_print_errors_fp(stderr);
+	exit(EXIT_FAILURE);
+}
+
+// client: keep the last session (TLS 1.3 tickets come after the handshake)
+static int tls_newsession (SSL* ssl, SSL_SESSION* session)
+{
+	(void)ssl;
+	pthread_mutex_lock(&tls_lock);
+	if (tls_session)
+		SSL_SESSION_free(tls_session);
+	tls_session = session;
+	pthread_mutex_unlock(&tls_lock);
+	return 1;
+}
+
+static void tls_selfsigned (void)
+{
+	EVP_PKEY* key = EVP_EC_gen("P-256");
+	X509* x = X509_new();
+	if (!key || !x)
+		tls_fail("self-signed certificate");
+	ASN1_INTEGER_set(X509_get_serialNumber(x), 1);
+	X509_gmtime_adj(X509_getm_notBefore(x), 0);
+	X509_gmtime_adj(X509_getm_notAfter(x), 365 * 24 * 3600L);
+	X509_set_pubkey(x, key);
+	X509_NAME* name = X509_get_subject_name(x);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"tcpechotester", -1, -1, 0);
+	X509_set_issuer_name(x, name);
+	if (   !X509_sign(x, key, EVP_sha256())
+	    || !SSL_CTX_use_certificate(tls_ctx, x)
+	    || !SSL_CTX_use_PrivateKey(tls_ctx, key))
+		tls_fail("self-signed certificate");
+	X509_free(x);
+	EVP_PKEY_free(key);
+}
+
+void tls_init (int server)
+{
+	// a peer leaving must not kill us, writes fail with EPIPE
+	signal(SIGPIPE, SIG_IGN);
+	
+	if ((tls_ctx = SSL_CTX_new(server? TLS_server_method(): TLS_client_method())) == NULL)
+		tls_fail("SSL_CTX_new");
+	SSL_CTX_set_mode(tls_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	if (ktls)
+		SSL_CTX_set_options(tls_ctx, SSL_OP_ENABLE_KTLS);
+	
+	if (tls_version)
+	{
+		// socat's names
+		int v = strcmp(tls_version, "TLS1.3") == 0? TLS1_3_VERSION:
+		        strcmp(tls_version, "TLS1.2") == 0? TLS1_2_VERSION:
+		        strcmp(tls_version, "TLS1.1") == 0? TLS1_1_VERSION:
+		        strcmp(tls_version, "TLS1") == 0? TLS1_VERSION: 0;
+		if (!v)
+		{
+			fprintf(stderr, "-M: TLS1, TLS1.1, TLS1.2 or TLS1.3\n");
+			exit(EXIT_FAILURE);
+		}
+		SSL_CTX_set_min_proto_version(tls_ctx, v);
+		SSL_CTX_set_max_proto_version(tls_ctx, v);
+	}
+	
+	if (!server)
+	{
+		// no verification, like socat's verify=0
+		SSL_CTX_set_verify(tls_ctx, SSL_VERIFY_NONE, NULL);
+		SSL_CTX_set_session_cache_mode(tls_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(tls_ctx, tls_newsession);
+		return;
+	}
+	
+	if (!tls_cert)
+	{
+		tls_selfsigned();
+		return;
+	}
+	char* cert = strdup(tls_cert);
+	char* key = strchr(cert, ',');
+	if (key)
+		*key++ = 0;
+	if (   SSL_CTX_use_certificate_chain_file(tls_ctx, cert) != 1
+	    || SSL_CTX_use_PrivateKey_file(tls_ctx, key?: cert, SSL_FILETYPE_PEM) != 1)
+		tls_fail(tls_cert);
+	free(cert);
+}
+
+// blocking handshake, returns its duration in ns or -1
+static long long tls_handshake_run (SSL* ssl, int sock, int server)
+{
+	// a silent client does not hold a server thread forever
+	struct timeval tv = { .tv_sec = server? TLS_ACCEPT_TIMEOUT: 0, };
+	long long t = nowns();
+	setcntl(sock, F_SETFL, 0, "O_NONBLOCK");
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	if ((server? SSL_accept(ssl): SSL_connect(ssl)) != 1)
+	{
+		if (ERR_peek_error())
+			ERR_print_errors_fp(stderr);
+		else
+			fprintf(stderr, "TLS handshake: %s\n", errno? strerror(errno): "peer has closed");
+		return -1;
+	}
+	t = nowns() - t;
+	tv.tv_sec = 0;
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	setcntl(sock, F_SETFL, O_NONBLOCK, "O_NONBLOCK");
+	return t;
+}
+
+static int tls_path (SSL* ssl)
+{
+#ifndef OPENSSL_NO_KTLS
+	return (BIO_get_ktls_send(SSL_get_wbio(ssl))? TLS_KTLS_TX: 0) | (BIO_get_ktls_recv(SSL_get_rbio(ssl))? TLS_KTLS_RX: 0);
+#else
+	(void)ssl;
+	return TLS_USER;
+#endif
+}
+
+// client: TLS 1.3 tickets come after the handshake, with the first data,
+// wait (a while) for one so that the next connections resume
+static void tls_ticket (SSL* ssl, int sock)
+{
+	long long end = nowns() + TLS_TICKET_WAIT * 1000000LL;
+	for (;;)
+	{
+		pthread_mutex_lock(&tls_lock);
+		int got = tls_session != NULL;
+		pthread_mutex_unlock(&tls_lock);
+		long long left = end - nowns();
+		char c;
+		int r;
+		if (got || left <= 0 || (r = SSL_peek(ssl, &c, 1)) > 0 || SSL_get_error(ssl, r) != SSL_ERROR_WANT_READ)
+			break;
+		struct pollfd pollfd = { .fd = sock, .events = POLLIN, };
+		poll(&pollfd, 1, left / 1000000 + 1);
+	}
+	ERR_clear_error();
+}
+
+// after a handshake, returns the record path
+static int tls_done (SSL* ssl, long long t, int show)
+{
+	int path = tls_path(ssl);
+	__atomic_fetch_add(&tls_paths[path], 1, __ATOMIC_RELAXED);
+	if (show)
+	{
+		printf("%s %s, handshake", SSL_get_version(ssl), SSL_get_cipher_name(ssl));
+		printns(t, NULL);
+		printf(" (%s), %s\n", SSL_session_reused(ssl)? "resumed": "full", tls_pathname[path]);
+		fflush(stdout);
+	}
+	return path;
+}
+
+// returns 0 when the connection is over
+static int tls_pump_io (struct tls_pump* p, int* rdwant, int* wrwant)
+{
+	int progress = 1;
+	while (progress)
+	{
+		progress = 0;
+		
+		// TLS to plain, pending records are read as soon as there is room
+		if (!p->downlen)
+		{
+			int ret = SSL_read(p->ssl, p->down, sizeof(p->down));
+			if (ret > 0)
+			{
+				p->downoff = 0;
+				p->downlen = ret;
+				p->bytes += ret;
+				progress = 1;
+			}
+			else if ((*rdwant = SSL_get_error(p->ssl, ret)) != SSL_ERROR_WANT_READ && *rdwant != SSL_ERROR_WANT_WRITE)
+				return 0;
+		}
+		if (p->downlen)
+		{
+			ssize_t ret = send(p->plain, p->down + p->downoff, p->downlen, MSG_NOSIGNAL | MSG_DONTWAIT);
+			if (ret == -1 && errno != EAGAIN)
+				return 0;
+			if (ret > 0)
+			{
+				p->downoff += ret;
+				p->downlen -= ret;
+				progress = 1;
+			}
+		}
+		
+		// plain to TLS
+		if (!p->uplen)
+		{
+			ssize_t ret = recv(p->plain, p->up, sizeof(p->up), MSG_DONTWAIT);
+			if (ret == 0 || (ret == -1 && errno != EAGAIN))
+				return 0;
+			if (ret > 0)
+			{
+				p->upoff = 0;
+				p->uplen = ret;
+				progress = 1;
+			}
+		}
+		if (p->uplen)
+		{
+			int ret = SSL_write(p->ssl, p->up + p->upoff, p->uplen);
+			if (ret > 0)
+			{
+				p->upoff += ret;
+				p->uplen -= ret;
+				p->bytes += ret;
+				progress = 1;
+			}
+			else if ((*wrwant = SSL_get_error(p->ssl, ret)) != SSL_ERROR_WANT_READ && *wrwant != SSL_ERROR_WANT_WRITE)
+				return 0;
+		}
+	}
+	return 1;
+}
+
+static void* tls_run (void* arg)
+{
+	struct tls_pump* p = (struct tls_pump*)arg;
+	int rdwant = SSL_ERROR_WANT_READ;
+	int wrwant = SSL_ERROR_WANT_WRITE;
+	
+	// server: the loop already has the other end, data waits in the socketpair
+	if (!SSL_is_init_finished(p->ssl))
+	{
+		long long t = tls_handshake_run(p->ssl, p->sock, 1);
+		if (t < 0)
+			goto out;
+		p->path = tls_done(p->ssl, t, 1);
+	}
+	
+	while (tls_pump_io(p, &rdwant, &wrwant))
+	{
+		struct pollfd pollfd [2] = { { .fd = p->sock, }, { .fd = p->plain, }, };
+		if (!p->downlen)
+			pollfd[0].events |= rdwant == SSL_ERROR_WANT_WRITE? POLLOUT: POLLIN;
+		if (p->uplen)
+			pollfd[0].events |= wrwant == SSL_ERROR_WANT_READ? POLLIN: POLLOUT;
+		if (!p->uplen)
+			pollfd[1].events |= POLLIN;
+		if (p->downlen)
+			pollfd[1].events |= POLLOUT;
+		if (poll(pollfd, 2, -1) == -1 && errno != EINTR)
+		{
+			perror("poll");
+			break;
+		}
+	}
+	
+out:
+	SSL_shutdown(p->ssl);
+	SSL_free(p->ssl);
+	close(p->sock);
+	close(p->plain);
+	
+	struct timespec cpu;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+	pthread_mutex_lock(&tls_lock);
+	tls_bytes[p->path] += p->bytes;
+	tls_cpu[p->path] += cpu.tv_sec + 1e-9 * cpu.tv_nsec;
+	tls_pumps--;
+	pthread_mutex_unlock(&tls_lock);
+	free(p);
+	return NULL;
+}
+
+// sock is connected (client) or accepted (server), returns the fd to use
+// instead (-1: failed server handshake)
+int tls_wrap (int sock, int server)
+{
+	SSL* ssl;
+	int path = TLS_USER;
+	if ((ssl = SSL_new(tls_ctx)) == NULL || !SSL_set_fd(ssl, sock))
+		tls_fail("SSL_new");
+	
+	if (server && !ktls)
+		// in the pump thread
+		SSL_set_accept_state(ssl);
+	else
+	{
+		// with ktls, a server is in tls_accept's thread
+		if (!server)
+		{
+			pthread_mutex_lock(&tls_lock);
+			if (tls_session)
+				SSL_set_session(ssl, tls_session);
+			pthread_mutex_unlock(&tls_lock);
+		}
+		
+		long long t = tls_handshake_run(ssl, sock, server);
+		if (t < 0)
+		{
+			if (!server)
+				exit(EXIT_FAILURE);
+			SSL_free(ssl);
+			close(sock);
+			return -1;
+		}
+		if (!server)
+		{
+			hist_add(&tls_handshake, t);
+			if (SSL_session_reused(ssl))
+				tls_resumed++;
+			pthread_mutex_lock(&tls_lock);
+			int wait = tls_ticketwait && !tls_session && SSL_version(ssl) >= TLS1_3_VERSION;
+			pthread_mutex_unlock(&tls_lock);
+			if (wait)
+				tls_ticket(ssl, sock);
+		}
+		
+		// the kernel does both ways: the socket is used as is, read() fails
+		// with EIO on a record which is not data, TLS 1.3 sends some after
+		// the handshake (session tickets, key updates), SSL_read() in the
+		// pump takes them (recvmsg() and the record type)
+		path = tls_done(ssl, t, server || tls_every || tls_handshake.count == 1);
+		if (path == TLS_KTLS_TXRX && SSL_version(ssl) < TLS1_3_VERSION)
+		{
+			SSL_free(ssl);
+			return sock;
+		}
+	}
+	
+	int fds [2];
+	struct tls_pump* p = (struct tls_pump*)malloc(sizeof(struct tls_pump));
+	if (!p || socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1)
+	{
+		perror("tls_wrap");
+		exit(EXIT_FAILURE);
+	}
+	p->ssl = ssl;
+	p->sock = sock;
+	p->plain = fds[1];
+	p->downlen = p->uplen = 0;
+	p->path = path;
+	p->bytes = 0;
+	pthread_mutex_lock(&tls_lock);
+	tls_pumps++;
+	pthread_mutex_unlock(&tls_lock);
+	
+	pthread_t thread;
+	int err = pthread_create(&thread, NULL, tls_run, p);
+	if (err)
+	{
+		fprintf(stderr, "pthread_create: %s\n", strerror(err));
+		exit(EXIT_FAILURE);
+	}
+	pthread_detach(thread);
+	return fds[0];
+}
+
+// -t ktls server: keys must be in the kernel before any data, so the
+// handshake is synchronous, in a thread of its own, the event loop gets the
+// fd to use from notify (a pipe) when it is done
+struct tls_accept
+{
+	int sock;
+	int notify;
+};
+
+static void* tls_accept_run (void* arg)
+{
+	struct tls_accept a = *(struct tls_accept*)arg;
+	free(arg);
+	int fd = tls_wrap(a.sock, 1);
+	if (fd != -1 && write(a.notify, &fd, sizeof(fd)) != sizeof(fd))
+	{
+		perror("tls_accept");
+		close(fd);
+	}
+	return NULL;
+}
+
+void tls_accept (int sock, int notify)
+{
+	struct tls_accept* a = (struct tls_accept*)malloc(sizeof(struct tls_accept));
+	if (!a)
+	{
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	a->sock = sock;
+	a->notify = notify;
+	
+	pthread_t thread;
+	int err = pthread_create(&thread, NULL, tls_accept_run, a);
+	if (err)
+	{
+		fprintf(stderr, "pthread_create: %s\n", strerror(err));
+		exit(EXIT_FAILURE);
+	}
+	pthread_detach(thread);
+}
+
+// tx+rx: the kernel does the records in our read() and write(), the loop
+// tells what it moved when the socket is closed (a pump counts its own)
+void tls_close (int sock, long long bytes)
+{
+	char ulp [16] = "";
+	socklen_t len = sizeof(ulp);
+	if (getsockopt(sock, IPPROTO_TCP, TCP_ULP, ulp, &len) == 0 && strcmp(ulp, "tls") == 0)
+		__atomic_fetch_add(&tls_bytes[TLS_KTLS_TXRX], bytes, __ATOMIC_RELAXED);
+}
+
+void tls_summary (void)
+{
+	if (!tls_handshake.count)
+		return;
+	
+	// pumps end after the loops close their side
+	for (int wait = 100; wait > 0 && __atomic_load_n(&tls_pumps, __ATOMIC_RELAXED); wait--)
+		usleep(10000);
+	
+	// the pumps have their own cpu time, what remains (loops, kernel
+	// records for tx+rx) is shared by bytes
+	double cpu [4];
+	double rest = cputime();
+	long long bytes = 0;
+	pthread_mutex_lock(&tls_lock);
+	for (int i = 0; i < 4; i++)
+	{
+		rest -= tls_cpu[i];
+		bytes += tls_bytes[i];
+	}
+	for (int i = 0; i < 4; i++)
+		cpu[i] = tls_cpu[i] + (bytes? rest * tls_bytes[i] / bytes: 0);
+	pthread_mutex_unlock(&tls_lock);
+	
+	if (output != OUTPUT_TEXT)
+	{
+		stat_record(&(struct record){ .type = "tls_handshake", .stream = -1, .interval = te - tb,
+			.count = tls_resumed, .total_count = tls_handshake.count, .lat = &tls_handshake, });
+		for (int i = 0; i < 4; i++)
+			if (tls_paths[i])
+				stat_record(&(struct record){ .type = tls_pathtype[i], .stream = -1, .interval = te - tb,
+					.bytes = tls_bytes[i], .total_bytes = tls_bytes[i],
+					.count = tls_paths[i], .total_count = tls_paths[i], .cpu = cpu[i], });
+		return;
+	}
+	printf("TLS: %lli handshakes, %lli resumed ", tls_handshake.count, tls_resumed);
+	printhist(&tls_handshake);
+	printf("\n");
+	for (int i = 0; i < 4; i++)
+		if (tls_paths[i])
+		{
+			printf("TLS: %lli connections with %s ", tls_paths[i], tls_pathname[i]);
+			printsz(tls_bytes[i], NULL);
+			if (tls_bytes[i])
+				printf("[cpu:%g s/GiB]", cpu[i] / tls_bytes[i] * (1<<30));
+			printf("\n");
+		}
+}
+#endif // TLS
+
+// offset-keyed pattern (-c -3): every 32-bit word is a hash of its absolute
+// stream offset and of a key, so nothing repeats and a lost or duplicated
+// block is always seen, generated and checked 8 words at a time (SIMD)
+
+#define SHOW 16 // bytes shown around a difference
+
+typedef uint32_t v8u32 __attribute__((vector_size(32)));
+int keyed = 0;
+uint32_t pattern_key;
+
+// same on scalars and vectors (a macro: no vector passing ABI)
+#define PATTERN_MIX(x) do { x *= 0x9e3779b1u; x ^= x >> 15; x *= 0x85ebca77u; x ^= x >> 13; } while (0)
+
+// key of the 2^32 words (16GiB) block holding word w
+static inline uint32_t pattern_blockkey (uint64_t w)
+{
+	uint32_t k = (uint32_t)(w >> 32) ^ ~pattern_key;
+	PATTERN_MIX(k);
+	return pattern_key + k;
+}
+
+static inline uint32_t pattern_word (uint64_t w)
+{
+	uint32_t x = (uint32_t)w ^ pattern_blockkey(w);
+	PATTERN_MIX(x);
+	return x;
+}
+
+static inline uint8_t pattern_byte (long long off)
+{
+	return pattern_word(off >> 2) >> (8 * (off & 3));
+}
+
+// fill buf with the pattern at stream offset off
+__attribute__((target_clones("avx2", "default")))
+void pattern_fill (char* buf, long long off, size_t len)
+{
+	size_t i = 0;
+	for (; i < len && ((off + i) & 3); i++)
+		buf[i] = pattern_byte(off + i);
+	while (len - i >= 32)
+	{
+		uint64_t w = (off + i) >> 2;
+		uint64_t next = (w | 0xffffffffULL) + 1; // next key block
+		if (next - w < 8)
+		{
+			// crossing a key block
+			uint32_t x = pattern_word(w);
+			memcpy(buf + i, &x, 4);
+			i += 4;
+			continue;
+		}
+		v8u32 k = { 0, 0, 0, 0, 0, 0, 0, 0, };
+		k += pattern_blockkey(w);
+		v8u32 idx = { 0, 1, 2, 3, 4, 5, 6, 7, };
+		idx += (uint32_t)w;
+		for (; len - i >= 32 && next - w >= 8; i += 32, w += 8, idx += 8)
+		{
+			v8u32 x = idx ^ k;
+			PATTERN_MIX(x);
+			memcpy(buf + i, &x, 32);
+		}
+	}
+	for (; i < len; i++)
+		buf[i] = pattern_byte(off + i);
+}
+
+// returns index of first byte differing from the pattern at off, or -1
+__attribute__((target_clones("avx2", "default")))
+ssize_t pattern_check (const char* buf, long long off, size_t len)
+{
+	size_t i = 0;
+	for (; i < len && ((off + i) & 3); i++)
+		if ((uint8_t)buf[i] != pattern_byte(off + i))
+			return i;
+	while (len - i >= 32)
+	{
+		uint64_t w = (off + i) >> 2;
+		uint64_t next = (w | 0xffffffffULL) + 1; // next key block
+		if (next - w < 8)
+		{
+			uint32_t x = pattern_word(w);
+			if (memcmp(buf + i, &x, 4) != 0)
+				break;
+			i += 4;
+			continue;
+		}
+		v8u32 k = { 0, 0, 0, 0, 0, 0, 0, 0, };
+		k += pattern_blockkey(w);
+		v8u32 idx = { 0, 1, 2, 3, 4, 5, 6, 7, };
+		idx += (uint32_t)w;
+		// differences are accumulated over 256 bytes before a test
+		while (len - i >= 256 && next - w >= 64)
+		{
+			v8u32 acc = { 0, 0, 0, 0, 0, 0, 0, 0, };
+			for (int j = 0; j < 8; j++, idx += 8)
+			{
+				v8u32 x = idx ^ k;
+				PATTERN_MIX(x);
+				v8u32 d;
+				memcpy(&d, buf + i + 32 * j, 32);
+				acc |= d ^ x;
+			}
+			uint64_t t [4];
+			memcpy(t, &acc, 32);
+			if (t[0] | t[1] | t[2] | t[3])
+				goto bytewise;
+			i += 256;
+			w += 64;
+		}
+		for (; len - i >= 32 && next - w >= 8; i += 32, w += 8, idx += 8)
+		{
+			v8u32 x = idx ^ k;
+			PATTERN_MIX(x);
+			v8u32 d;
+			memcpy(&d, buf + i, 32);
+			d ^= x;
+			uint64_t t [4];
+			memcpy(t, &d, 32);
+			if (t[0] | t[1] | t[2] | t[3])
+				goto bytewise;
+		}
+	}
+bytewise:
+	for (; i < len; i++)
+		if ((uint8_t)buf[i] != pattern_byte(off + i))
+			return i;
+	return -1;
+}
+
+// show around a pattern mismatch at stream offset off (buf[i])
+void pattern_dump (const char* buf, size_t len, size_t i, long long off)
+{
+	printf("offset-diff @%lli @0x%llx\n", off, off);
+	for (size_t j = i > SHOW? i - SHOW: 0; j < i + SHOW && j < len; j++)
+	{
+		unsigned char c = buf[j];
+		unsigned char d = pattern_byte(off - i + j);
+		printf("@%llx:R%02x(%c)/S%02x(%c)%s\n",
+			off - i + j,
+			c, c>31?c:'.',
+			d, d>31?d:'.',
+			c != d? " (diff)": "");
+	}
+	printf("\n");
+}
+
+// comparator verification state, one per connection
+struct stream
+{
+	int fd;
+	int id;
+	int datasize;
+	ssize_t maxdiff;
+	long long total_sent;
+	long long total_recvd;
+	int ptr_to_send;
+	int ptr_for_bufout_compare;
+	long long data_in_loop;
+	int wantout;
+	const char* txbuf; // bufout or zero-copy region, stored twice
+	int txlen;         // power of 2
+	int zc;            // MSG_ZEROCOPY sends
+	struct latsample* lat; // -L, in-flight chunks
+	unsigned latsize;      // power of 2
+	unsigned lathead;
+	unsigned lattail;
+	char* gen;        // -c -3, pattern window of buflen bytes
+	long long gen_off; // its stream offset
+};
+
+double serial_cps = 0; // -y line rate in chars/s (frames), 0: no line
+int serial_cpu = 0;    // -y: cpu time per interval
+int serial_vmin = 0;   // -V: wake up when that many chars are queued
+int serial_vms = 10;   // -V: or after that many ms
+
+// report interval [ti, te]
+void showbw (struct stream* streams, int nstreams)
+{
+	if (output != OUTPUT_TEXT)
+	{
+		stat_record(&(struct record){ .type = "interval", .stream = -1, .interval = te - ti,
+			.bytes = data_in_loop, .total_bytes = data_overall, .lat = &lat_interval, });
+		for (int i = 0; i < nstreams; i++)
+		{
+			stat_record(&(struct record){ .type = "stream", .stream = streams[i].id, .interval = te - ti,
+				.bytes = streams[i].data_in_loop, .total_bytes = streams[i].total_recvd, });
+			streams[i].data_in_loop = 0;
+		}
+		hist_reset(&lat_interval);
+		stat_snapshot = 0;
+		ti = te;
+		data_in_loop = 0;
+		return;
+	}
+	
+	printf("\r");
+	printbw(te - tb, data_overall, "avg:");
+	printbw(te - ti, data_in_loop, "now:");
+	printsz(data_overall, "size:");
+	if (serial_cps && te > ti)
+		printf("[line:%.1f%%]", 100.0 * data_in_loop * 1e9 / (te - ti) / serial_cps);
+	if (serial_cpu)
+	{
+		static double last = 0;
+		double cpu = cputime();
+		if (data_in_loop)
+			printf("[cpu:%.3g s/MiB]", (cpu - last) / data_in_loop * (1<<20));
+		last = cpu;
+	}
+	if (zcstats.completed)
+		printf("[zc:%lli%%]", 100 * (zcstats.completed - zcstats.copied) / zcstats.completed);
+	for (int i = 0; i < nstreams; i++)
+	{
+		char head[16];
+		snprintf(head, sizeof head, "#%i:", streams[i].id);
+		printbw(te - ti, streams[i].data_in_loop, head);
+		streams[i].data_in_loop = 0;
+	}
+	if (lat_interval.count)
+	{
+		printhist(&lat_interval);
+		hist_reset(&lat_interval);
+	}
+	printf("-----");
+	stat_endline();
+	ti = te;
+	data_in_loop = 0;
+}
+
+void stream_init (struct stream* s, int fd, int id, int datasize, ssize_t maxdiff)
+{
+	memset(s, 0, sizeof(*s));
+	s->fd = fd;
+	s->id = id;
+	s->maxdiff = maxdiff;
+	if (datasize < 0)
+		datasize = (random() % -datasize) + 1;
+	s->datasize = datasize;
+	s->txbuf = bufout;
+	s->txlen = buflen;
+	if (keyed)
+	{
+		if ((s->gen = (char*)malloc(buflen)) == NULL)
+		{
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		s->gen_off = -1;
+	}
+	if (latency)
+	{
+		s->latsize = 1024;
+		if ((s->lat = (struct latsample*)malloc(s->latsize * sizeof(struct latsample))) == NULL)
+		{
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+void stream_free (struct stream* s)
+{
+	free(s->lat);
+	s->lat = NULL;
+	free(s->gen);
+	s->gen = NULL;
+}
+
+// the next size (<= buflen) bytes to send
+const char* stream_txdata (struct stream* s, ssize_t size)
+{
+	if (!s->gen)
+		return s->txbuf + s->ptr_to_send;
+	if (s->gen_off < 0 || s->total_sent < s->gen_off || s->total_sent + size > s->gen_off + buflen)
+	{
+		s->gen_off = s->total_sent;
+		pattern_fill(s->gen, s->gen_off, buflen);
+	}
+	return s->gen + (s->total_sent - s->gen_off);
+}
+
+// remember when the chunk ending at total_sent was sent
+void stream_sent (struct stream* s)
+{
+	if (s->lattail - s->lathead == s->latsize)
+	{
+		// full, double
+		struct latsample* lat = (struct latsample*)malloc(2 * s->latsize * sizeof(struct latsample));
+		if (!lat)
+		{
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		for (unsigned i = 0; i < s->latsize; i++)
+			lat[i] = s->lat[(s->lathead + i) & (s->latsize - 1)];
+		free(s->lat);
+		s->lat = lat;
+		s->lathead = 0;
+		s->lattail = s->latsize;
+		s->latsize *= 2;
+	}
+	struct latsample* l = &s->lat[s->lattail++ & (s->latsize - 1)];
+	l->end = s->total_sent;
+	l->t = nowns();
+}
+
+// account chunks entirely received
+void stream_echoed (struct stream* s)
+{
+	long long now = 0;
+	while (s->lathead != s->lattail)
+	{
+		struct latsample* l = &s->lat[s->lathead & (s->latsize - 1)];
+		if (l->end > s->total_recvd)
+			break;
+		if (!now)
+			now = nowns();
+		hist_add(&lat_interval, now - l->t);
+		hist_add(&lat_overall, now - l->t);
+		s->lathead++;
+	}
+}
+
+// switch to MSG_ZEROCOPY sends if possible
+void stream_zerocopy (struct stream* s)
+{
+	if (zc_enable(s->fd))
+	{
+		s->zc = 1;
+		s->txbuf = zc_region();
+		s->txlen = zclen;
+		s->ptr_to_send = s->total_sent & (zclen - 1);
+	}
+}
+
+int stream_cont (const struct stream* s)
+{
+	return !s->datasize || s->datasize > s->total_sent || s->datasize > s->total_recvd;
+}
+
+int stream_wantout (const struct stream* s)
+{
+	return !s->maxdiff || s->total_recvd > s->total_sent - s->maxdiff;
+}
+
+// verify received data against bufout
+void stream_check (struct stream* s, const char* bufin, ssize_t ret)
+{
+	if (keyed)
+	{
+		ssize_t i = pattern_check(bufin, s->total_recvd, ret);
+		if (i >= 0)
+		{
+			fprintf(stderr, "\ndata differ (stream=%i sent=%lli revcd=%lli tocheck=%i)\n",
+				s->id, s->total_sent, s->total_recvd, (int)ret);
+			pattern_dump(bufin, ret, i, s->total_recvd + i);
+			exit(EXIT_FAILURE);
+		}
+		s->total_recvd += ret;
+		s->data_in_loop += ret;
+		if (s->lat)
+			stream_echoed(s);
+		return;
+	}
+	
+	ssize_t bufin_offset = 0;
+	while (ret)
+	{
+		ssize_t size = ret;
+		if (size > buflen)
+			size = buflen;
+		if (memcmp(bufin + bufin_offset, bufout + s->ptr_for_bufout_compare, size) != 0)
+		{
+			fprintf(stderr, "\ndata differ (stream=%i sent=%lli revcd=%lli ptrsend=%i ptr_for_bufout_compare=%i tocheck=%i)\n",
+				s->id,
+				s->total_sent,
+				s->total_recvd,
+				s->ptr_to_send,
+				s->ptr_for_bufout_compare,
+				(int)ret);
+			int i;
+			for (i = 0; i < size; i++)
+				if (bufin[i + bufin_offset] != bufout[i + s->ptr_for_bufout_compare])
+				{
+					printf("offset-diff @%lli @0x%llx\n", i + s->total_recvd, i + s->total_recvd);
+					break;
+				}
+			// difference is at bufin[i + bufin_offset] and bufout[i + ptr_for_bufout_compare]
+			// show SHOW before
+			ssize_t start = i - SHOW;
+			for (ssize_t j = start + buflen; j < i + buflen; j++)
+			{
+				unsigned char c = bufout[(j + s->ptr_for_bufout_compare) & (buflen - 1)];
+				printf("@%llx:R%02x(%c)/S%02x(%c)\n",
+					j + s->total_recvd - buflen,
+					c, c>31?c:'.',
+					c, c>31?c:'.');
+			}
+			// show SHOW after
+			for (ssize_t j = i; j < i + SHOW && j + bufin_offset < size; j++)
+			{
+				unsigned char c = (uint8_t)bufin[j + bufin_offset];
+				unsigned char d = (uint8_t)bufout[(j + s->ptr_for_bufout_compare) & (buflen - 1)];
+				printf("@%llx:R%02x(%c)/S%02x(%c) (diff)\n",
+					j + s->total_recvd,
+					c, c>31?c:'.',
+					d, d>31?d:'.');
+			}
+			printf("\n");
+			
+			exit(EXIT_FAILURE);
+		}
+		s->total_recvd += size;
+		s->data_in_loop += size;
+		s->ptr_for_bufout_compare = (s->ptr_for_bufout_compare + size) & (buflen - 1);
+		ret -= size;
+		bufin_offset += size;
+	}
+	if (s->lat)
+		stream_echoed(s);
+}
+
+// read what is available into bufin and verify it
+// returns read()'s value
+ssize_t stream_recv (struct stream* s, char* bufin)
+{
+	ssize_t ret = read(s->fd, bufin, buflen);
+	if (ret > 0)
+		stream_check(s, bufin, ret);
+	return ret;
+}
+
+// how much can be sent from ptr_to_send
+ssize_t stream_sendsize (const struct stream* s)
+{
+	// txbuf holds the pattern twice
+	ssize_t size = s->txlen;
+	if (s->datasize && (s->total_sent + size > s->datasize))
+		size = s->datasize - s->total_sent;
+	if (s->maxdiff && size > (s->total_recvd - s->total_sent + s->maxdiff))
+		size = s->total_recvd - s->total_sent + s->maxdiff;
+	return size;
+}
+
+// returns write()'s value (0 if nothing to send)
+ssize_t stream_send (struct stream* s)
+{
+	ssize_t size = stream_sendsize(s);
+	if (!size)
+		return 0;
+	ssize_t ret;
+	if (s->zc)
+	{
+		ret = send(s->fd, s->txbuf + s->ptr_to_send, size, MSG_ZEROCOPY);
+		if (ret == -1 && errno == ENOBUFS)
+		{
+			// too many pending notifications
+			zc_reap(s->fd);
+			errno = EAGAIN;
+		}
+		if (ret >= 0)
+			zcstats.sends++;
+	}
+	else
+		ret = write(s->fd, stream_txdata(s, size), size);
+	if (ret > 0)
+	{
+		s->total_sent += ret;
+		s->ptr_to_send = (s->ptr_to_send + ret) & (s->txlen - 1);
+		if (s->lat)
+			stream_sent(s);
+	}
+	return ret;
+}
+
+#if URING
+
+// io_uring backend (raw syscalls, no liburing):
+// bufout and the receive pool are registered buffers,
+// reception is a multishot recv over a provided buffer ring,
+// sends are batched as chains of linked MSG_WAITALL sends
+
+#define URING_ENTRIES 64
+#define URING_BUFS 64 // provided buffers, power of 2
+#define URING_BUFMAX (1<<18) // provided buffer max size
+#define URING_CHAIN 16 // max linked sends per submission
+#define URING_BGID 0
+
+enum { URING_RECV = 1, URING_SEND = 2, URING_STAT = 3 };
+
+struct uring
+{
+	int fd;
+	void* sq_ptr;
+	size_t sq_len;
+	void* cq_ptr;
+	size_t cq_len;
+	struct io_uring_sqe* sqes;
+	size_t sqes_len;
+	unsigned sq_entries;
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* sq_array;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	struct io_uring_cqe* cqes;
+	unsigned to_submit;
+	int sendfixed; // kernel accepts registered buffers with send
+	struct io_uring_buf_ring* br;
+	size_t br_len;
+	unsigned short br_tail;
+	char* pool; // URING_BUFS * bufsz
+	int bufsz;
+	int starved; // recv ended on ENOBUFS: fd to rearm when a buffer is back, 0: none
+};
+
+static int uring_register (struct uring* u, unsigned op, void* arg, unsigned nr)
+{
+	return syscall(__NR_io_uring_register, u->fd, op, arg, nr);
+}
+
+static void uring_recv (struct uring* u, int sock);
+
+static void uring_recycle (struct uring* u, int bid)
+{
+	struct io_uring_buf* b = &u->br->bufs[u->br_tail & (URING_BUFS - 1)];
+	b->addr = (unsigned long)(u->pool + bid * u->bufsz);
+	b->len = u->bufsz;
+	b->bid = bid;
+	u->br_tail++;
+	__atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+	if (u->starved)
+	{
+		uring_recv(u, u->starved);
+		u->starved = 0;
+	}
+}
+
+void uring_exit (struct uring* u)
+{
+	if (u->fd >= 0)
+		close(u->fd);
+	if (u->sqes && u->sqes != MAP_FAILED)
+		munmap(u->sqes, u->sqes_len);
+	if (u->cq_ptr && u->cq_ptr != MAP_FAILED && u->cq_ptr != u->sq_ptr)
+		munmap(u->cq_ptr, u->cq_len);
+	if (u->sq_ptr && u->sq_ptr != MAP_FAILED)
+		munmap(u->sq_ptr, u->sq_len);
+	if (u->br && u->br != MAP_FAILED)
+		munmap(u->br, u->br_len);
+	free(u->pool);
+}
+
+// returns 0 when io_uring is not available
+int uring_init (struct uring* u)
+{
+	struct io_uring_params p;
+	
+	memset(u, 0, sizeof(*u));
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+	if ((u->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p)) == -1 && errno == EINVAL)
+	{
+		// older kernel
+		memset(&p, 0, sizeof(p));
+		u->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	}
+	if (u->fd == -1)
+	{
+		perror("io_uring_setup");
+		return 0;
+	}
+	
+	u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		u->sq_len = u->cq_len = u->sq_len > u->cq_len? u->sq_len: u->cq_len;
+	u->sq_ptr = mmap(NULL, u->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (u->sq_ptr == MAP_FAILED)
+	{
+		perror("mmap(sq)");
+		uring_exit(u);
+		return 0;
+	}
+	u->cq_ptr = u->sq_ptr;
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP))
+	{
+		u->cq_ptr = mmap(NULL, u->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+		if (u->cq_ptr == MAP_FAILED)
+		{
+			perror("mmap(cq)");
+			uring_exit(u);
+			return 0;
+		}
+	}
+	u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = (struct io_uring_sqe*)mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED)
+	{
+		perror("mmap(sqes)");
+		uring_exit(u);
+		return 0;
+	}
+	
+	u->sq_entries = p.sq_entries;
+	u->sq_head = (unsigned*)((char*)u->sq_ptr + p.sq_off.head);
+	u->sq_tail = (unsigned*)((char*)u->sq_ptr + p.sq_off.tail);
+	u->sq_mask = (unsigned*)((char*)u->sq_ptr + p.sq_off.ring_mask);
+	u->sq_array = (unsigned*)((char*)u->sq_ptr + p.sq_off.array);
+	u->cq_head = (unsigned*)((char*)u->cq_ptr + p.cq_off.head);
+	u->cq_tail = (unsigned*)((char*)u->cq_ptr + p.cq_off.tail);
+	u->cq_mask = (unsigned*)((char*)u->cq_ptr + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe*)((char*)u->cq_ptr + p.cq_off.cqes);
+	
+	// registered buffers: #0 is bufout, #1 is the receive pool
+	u->bufsz = buflen < URING_BUFMAX? buflen: URING_BUFMAX;
+	if ((u->pool = (char*)malloc(URING_BUFS * u->bufsz)) == NULL)
+	{
+		perror("malloc");
+		uring_exit(u);
+		return 0;
+	}
+	struct iovec iov[2] =
+	{
+		{ .iov_base = bufout, .iov_len = 2 * (size_t)buflen, },
+		{ .iov_base = u->pool, .iov_len = URING_BUFS * (size_t)u->bufsz, },
+	};
+	if (uring_register(u, IORING_REGISTER_BUFFERS, iov, 2) == -1)
+	{
+		perror("io_uring_register(buffers)");
+		uring_exit(u);
+		return 0;
+	}
+	
+	// provided buffer ring for multishot recv
+	u->br_len = URING_BUFS * sizeof(struct io_uring_buf);
+	u->br = (struct io_uring_buf_ring*)mmap(NULL, u->br_len, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if (u->br == MAP_FAILED)
+	{
+		perror("mmap(buf_ring)");
+		uring_exit(u);
+		return 0;
+	}
+	struct io_uring_buf_reg reg = { .ring_addr = (unsigned long)u->br, .ring_entries = URING_BUFS, .bgid = URING_BGID, };
+	if (uring_register(u, IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+	{
+		perror("io_uring_register(pbuf_ring)");
+		uring_exit(u);
+		return 0;
+	}
+	for (int i = 0; i < URING_BUFS; i++)
+		uring_recycle(u, i);
+	
+	return 1;
+}
+
+static struct io_uring_sqe* uring_sqe (struct uring* u)
+{
+	unsigned tail = *u->sq_tail;
+	if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries)
+		return NULL;
+	unsigned idx = tail & *u->sq_mask;
+	struct io_uring_sqe* sqe = &u->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	u->sq_array[idx] = idx;
+	// the kernel only reads the ring in io_uring_enter()
+	__atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	u->to_submit++;
+	return sqe;
+}
+
+// submit pending entries, wait for at least one completion
+static void uring_enter (struct uring* u)
+{
+	while (1)
+	{
+		int ret = syscall(__NR_io_uring_enter, u->fd, u->to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret >= 0)
+		{
+			u->to_submit -= ret;
+			return;
+		}
+		if (errno != EINTR)
+		{
+			perror("io_uring_enter");
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+static void uring_recv (struct uring* u, int sock)
+{
+	struct io_uring_sqe* sqe = uring_sqe(u);
+	assert(sqe);
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = sock;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BGID;
+	sqe->user_data = URING_RECV;
+}
+
+static void uring_send (struct uring* u, int sock, const char* buf, size_t len, int bufindex, int link)
+{
+	struct io_uring_sqe* sqe = uring_sqe(u);
+	assert(sqe);
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = sock;
+	sqe->addr = (unsigned long)buf;
+	sqe->len = len;
+	sqe->msg_flags = MSG_WAITALL;
+	if (u->sendfixed)
+	{
+		sqe->ioprio = IORING_RECVSEND_FIXED_BUF;
+		sqe->buf_index = bufindex;
+	}
+	sqe->flags = link? IOSQE_IO_LINK: 0;
+	sqe->user_data = URING_SEND | ((uint64_t)len << 8);
+}
+
+// wait for a report tick
+static void uring_stat (struct uring* u)
+{
+	if (statfd < 0)
+		return;
+	struct io_uring_sqe* sqe = uring_sqe(u);
+	assert(sqe);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = statfd;
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = URING_STAT;
+}
+
+// send with registered buffers needs a recent kernel,
+// try with an empty send
+static void uring_probe_sendfixed (struct uring* u, int sock)
+{
+	u->sendfixed = 1;
+	uring_send(u, sock, bufout, 0, 0, 0);
+	uring_enter(u);
+	unsigned head = *u->cq_head;
+	u->sendfixed = u->cqes[head & *u->cq_mask].res != -EINVAL;
+	__atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+}
+
+// run a mode over io_uring on a socket
+// returns 0 if not possible (caller falls back to poll)
+int echouring (int sock, int mode, struct stream* s)
+{
+	struct uring u;
+	int type;
+	socklen_t typelen = sizeof(type);
+	
+	if (getsockopt(sock, SOL_SOCKET, SO_TYPE, &type, &typelen) == -1)
+	{
+		fprintf(stderr, "io_uring backend needs a socket, using poll\n");
+		return 0;
+	}
+	if ((mode == MODE_COMPARATOR || mode == MODE_SOURCE) && keyed)
+	{
+		// linked sends would need a stable pattern buffer per chain
+		fprintf(stderr, "keyed pattern with io_uring not supported, using poll\n");
+		return 0;
+	}
+	if (!uring_init(&u))
+	{
+		fprintf(stderr, "io_uring not available, using poll\n");
+		return 0;
+	}
+	if (mode != MODE_SINK)
+		uring_probe_sendfixed(&u, sock);
+	
+	// responder: received buffers waiting to be sent back, in order
+	struct { int bid; int len; int off; } fifo [URING_BUFS];
+	unsigned fifo_head = 0, fifo_tail = 0;
+	int inflight = 0; // linked sends
+	
+	if (mode != MODE_COMPARATOR)
+		tb = ti = nowns();
+	if (mode != MODE_SOURCE)
+		uring_recv(&u, sock);
+	uring_stat(&u);
+	
+	int cont = 1;
+	while (cont)
+	{
+		// queue one chain of sends, only when previous one is done
+		// (chains are not ordered against each other)
+		if (!inflight) switch (mode)
+		{
+		case MODE_SOURCE:
+			for (inflight = 0; inflight < URING_CHAIN; inflight++)
+				uring_send(&u, sock, bufout, buflen, 0, inflight < URING_CHAIN - 1);
+			break;
+		case MODE_COMPARATOR:
+			for (inflight = 0; inflight < URING_CHAIN; inflight++)
+			{
+				ssize_t size = stream_sendsize(s);
+				if (!size)
+					break;
+				// with MSG_WAITALL, a send is complete or fails
+				uring_send(&u, sock, bufout + s->ptr_to_send, size, 0, 1);
+				s->total_sent += size;
+				s->ptr_to_send = (s->ptr_to_send + size) & (buflen - 1);
+				if (s->lat)
+					stream_sent(s);
+			}
+			if (inflight)
+				u.sqes[(*u.sq_tail - 1) & *u.sq_mask].flags &= ~IOSQE_IO_LINK;
+			break;
+		case MODE_RESPONDER:
+			for (unsigned f = fifo_head; f != fifo_tail && inflight < URING_CHAIN; f++, inflight++)
+			{
+				int i = f & (URING_BUFS - 1);
+				uring_send(&u, sock, u.pool + fifo[i].bid * u.bufsz + fifo[i].off, fifo[i].len - fifo[i].off, 1,
+					f + 1 != fifo_tail && inflight < URING_CHAIN - 1);
+			}
+			break;
+		}
+		
+		uring_enter(&u);
+		
+		unsigned head = *u.cq_head;
+		unsigned tail = __atomic_load_n(u.cq_tail, __ATOMIC_ACQUIRE);
+		for (; cont && head != tail; head++)
+		{
+			struct io_uring_cqe* cqe = &u.cqes[head & *u.cq_mask];
+			int res = cqe->res;
+			
+			if (cqe->user_data == URING_STAT)
+			{
+				if (stat_tick() && mode != MODE_RESPONDER)
+					showbw(NULL, 0);
+				uring_stat(&u);
+				continue;
+			}
+			
+			if ((cqe->user_data & 0xff) == URING_SEND)
+			{
+				inflight--;
+				if (res == -ECANCELED)
+					// a previous linked send was short, will be resent
+					continue;
+				if (res < 0)
+				{
+					fprintf(stderr, "send: %s\n", strerror(-res));
+					cont = 0;
+					continue;
+				}
+				if (mode == MODE_SOURCE)
+				{
+					data_in_loop += res;
+					data_overall += res;
+				}
+				else if (mode == MODE_COMPARATOR && res != (int)(cqe->user_data >> 8))
+				{
+					fprintf(stderr, "send: short write (%i/%i)\n", res, (int)(cqe->user_data >> 8));
+					exit(EXIT_FAILURE);
+				}
+				else if (mode == MODE_RESPONDER)
+				{
+					int i = fifo_head & (URING_BUFS - 1);
+					data_overall += res;
+					fifo[i].off += res;
+					if (fifo[i].off == fifo[i].len)
+					{
+						uring_recycle(&u, fifo[i].bid);
+						fifo_head++;
+					}
+				}
+				continue;
+			}
+			
+			// multishot recv
+			if (res == -ENOBUFS)
+			{
+				// all buffers were in use: comparator and sink have
+				// recycled them with the previous completions, the
+				// responder gets them back when its sends are done
+				if (cqe->flags & IORING_CQE_F_MORE)
+					;
+				else if (fifo_head != fifo_tail)
+					u.starved = sock;
+				else
+					uring_recv(&u, sock);
+				continue;
+			}
+			if (res <= 0)
+			{
+				if (res < 0)
+					fprintf(stderr, "recv: %s\n", strerror(-res));
+				else
+					fprintf(stderr, "peer has closed\n");
+				cont = 0;
+				continue;
+			}
+			
+			int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+			switch (mode)
+			{
+			case MODE_SINK:
+				if (keyed)
+					stream_check(s, u.pool + bid * u.bufsz, res);
+				data_in_loop += res;
+				data_overall += res;
+				uring_recycle(&u, bid);
+				break;
+			case MODE_COMPARATOR:
+				stream_check(s, u.pool + bid * u.bufsz, res);
+				data_in_loop += res;
+				data_overall += res;
+				uring_recycle(&u, bid);
+				break;
+			case MODE_RESPONDER:
+			{
+				int i = fifo_tail++ & (URING_BUFS - 1);
+				fifo[i].bid = bid;
+				fifo[i].len = res;
+				fifo[i].off = 0;
+				break;
+			}
+			}
+			if (!(cqe->flags & IORING_CQE_F_MORE))
+				uring_recv(&u, sock);
+		}
+		__atomic_store_n(u.cq_head, head, __ATOMIC_RELEASE);
+		
+		if (mode == MODE_COMPARATOR && cont)
+			cont = stream_cont(s);
+	}
+	
+	uring_exit(&u);
+	return 1;
+}
+
+#endif // URING
+
+// -V: with VMIN set (and VTIME 0) a tty polls readable only once VMIN
+// chars are queued, the short timeout then reads whatever has arrived
+int tty_poll (struct pollfd* fds, nfds_t n)
+{
+	if (!serial_vmin)
+		return poll(fds, n, 1000 /*ms*/);
+	int ret = poll(fds, n, serial_vms);
+	if (ret == 0 && (fds[0].events & POLLIN))
+	{
+		fds[0].revents = POLLIN;
+		ret = 1;
+	}
+	return ret;
+}
+
+void echocomparator (int sock, int datasize, ssize_t maxdiff)
+{
+	// bufout is already filled and not modified
+	// send bufout again and again
+	// verify bufin receives same data at same (offset mod bufsize)
+	
+	setcntl(sock, F_SETFL, O_NONBLOCK, "O_NONBLOCK");
+	
+	struct stream s;
+	struct pollfd pollfd [2] = { { .fd = sock, }, { .fd = statfd, .events = POLLIN, }, };
+	static long long tr;
+	static long long loop_count = 0;
+	
+	stream_init(&s, sock, 0, datasize, maxdiff);
+	
+	if (!data_overall)
+		tb = ti = tr = nowns();
+	
+	int cont = 1;
+#if URING
+	if (engine == ENGINE_URING && echouring(sock, MODE_COMPARATOR, &s))
+		cont = 0;
+#endif
+	if (cont && zerocopy)
+		stream_zerocopy(&s);
+	while (cont)
+	{
+		pollfd[0].events = POLLIN;
+		if (stream_wantout(&s))
+			pollfd[0].events |= POLLOUT;
+		int ret = tty_poll(pollfd, 2);
+		
+		if (ret == -1)
+		{
+			perror("poll");
+			exit(EXIT_FAILURE);
+		}
+
+		if (pollfd[0].revents & POLLIN)
+		{
+			ssize_t ret = stream_recv(&s, bufin);
+			if (ret == 0)
+				// closed?
+				break;
+			if (ret == -1 && errno != EAGAIN)
+			{
+				perror("read");
+				exit(EXIT_FAILURE);
+			}
+			if (ret > 0)
+			{
+				data_overall += ret;
+				data_in_loop += ret;
+			}
+		}
+		
+		if (s.zc && (pollfd[0].revents & POLLERR))
+			zc_reap(sock);
+		
+		if ((pollfd[0].revents & POLLOUT) && stream_send(&s) == -1 && errno != EAGAIN)
+		{
+			perror("write");
+			exit(EXIT_FAILURE);
+		}
+
+		if ((pollfd[1].revents & POLLIN) && stat_tick())
+			showbw(NULL, 0);
+		cont = stream_cont(&s);
+	}
+
+	++loop_count;
+	te = nowns();
+	if (te >= tr)
+	{
+		showbw(NULL, 0);
+		fprintf(stderr, "  send&received %lli / %lli bytes (=%i) -- (#%lld)          \r", s.total_sent, data_overall, s.datasize, loop_count);
+		tr += 1000000000LL;
+	}
+
+	if (s.zc)
+		zc_reap(sock);
+	stream_free(&s);
+	my_close(sock, s.total_sent + s.total_recvd);
+}
+
+void echocomparator_parallel (int nstreams, int datasize, ssize_t maxdiff, int nodelay, int doflushinput)
+{
+	// same as echocomparator, nstreams connections driven by one epoll loop
+	
+	struct stream* streams = (struct stream*)malloc(nstreams * sizeof(struct stream));
+	if (!streams)
+	{
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	
+	int ep = epoll_create1(0);
+	if (ep == -1)
+	{
+		perror("epoll_create1");
+		exit(EXIT_FAILURE);
+	}
+	
+	for (int i = 0; i < nstreams; i++)
+	{
+		int sock = my_socket();
+		if (nodelay)
+			setflag(sock, -1, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+		sock = my_connect(sock);
+		if (doflushinput && !flushinput(sock))
+			exit(EXIT_FAILURE);
+		setcntl(sock, F_SETFL, O_NONBLOCK, "O_NONBLOCK");
+		stream_init(&streams[i], sock, i, datasize, maxdiff);
+		if (zerocopy)
+			stream_zerocopy(&streams[i]);
+		
+		struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT, .data.ptr = &streams[i], };
+		streams[i].wantout = 1;
+		if (epoll_ctl(ep, EPOLL_CTL_ADD, sock, &ev) == -1)
+		{
+			perror("epoll_ctl");
+			exit(EXIT_FAILURE);
+		}
+	}
+	printf("%i connections to %s established.\n", nstreams, stat_peer);
+	
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &statfd, };
+	if (statfd >= 0 && epoll_ctl(ep, EPOLL_CTL_ADD, statfd, &ev) == -1)
+	{
+		perror("epoll_ctl");
+		exit(EXIT_FAILURE);
+	}
+	
+	if (!data_overall)
+		tb = ti = nowns();
+	
+	int running = nstreams;
+	while (running)
+	{
+		struct epoll_event evs[64];
+		int nev = epoll_wait(ep, evs, sizeof(evs) / sizeof(evs[0]), 1000 /*ms*/);
+		if (nev == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			exit(EXIT_FAILURE);
+		}
+		
+		for (int e = 0; e < nev; e++)
+		{
+			if (evs[e].data.ptr == &statfd)
+			{
+				if (stat_tick())
+					showbw(streams, nstreams);
+				continue;
+			}
+			
+			struct stream* s = (struct stream*)evs[e].data.ptr;
+			int cont = 1;
+			
+			if (evs[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+			{
+				ssize_t ret = stream_recv(s, bufin);
+				if (ret == 0)
+					cont = 0;
+				else if (ret == -1 && errno != EAGAIN)
+				{
+					perror("read");
+					exit(EXIT_FAILURE);
+				}
+				else if (ret > 0)
+				{
+					data_overall += ret;
+					data_in_loop += ret;
+				}
+			}
+			
+			if (s->zc && (evs[e].events & EPOLLERR))
+				zc_reap(s->fd);
+			
+			if (cont && (evs[e].events & EPOLLOUT) && stream_send(s) == -1 && errno != EAGAIN)
+			{
+				perror("write");
+				exit(EXIT_FAILURE);
+			}
+			
+			if (cont)
+				cont = stream_cont(s);
+			
+			if (!cont)
+			{
+				if (s->total_recvd < s->total_sent)
+					fprintf(stderr, "\nstream #%i: peer has closed (sent=%lli recvd=%lli)\n", s->id, s->total_sent, s->total_recvd);
+				if (s->zc)
+					zc_reap(s->fd);
+				epoll_ctl(ep, EPOLL_CTL_DEL, s->fd, NULL);
+				my_close(s->fd, s->total_sent + s->total_recvd);
+				s->fd = -1;
+				running--;
+				continue;
+			}
+			
+			int wantout = stream_wantout(s) && (!s->datasize || s->total_sent < s->datasize);
+			if (wantout != s->wantout)
+			{
+				struct epoll_event ev = { .events = EPOLLIN | (wantout? EPOLLOUT: 0), .data.ptr = s, };
+				if (epoll_ctl(ep, EPOLL_CTL_MOD, s->fd, &ev) == -1)
+				{
+					perror("epoll_ctl");
+					exit(EXIT_FAILURE);
+				}
+				s->wantout = wantout;
+			}
+		}
+		
+	}
+	
+	te = nowns();
+	showbw(streams, nstreams);
+	
+	if (output == OUTPUT_TEXT)
+		printf("\n");
+	for (int i = 0; i < nstreams; i++)
+	{
+		stream_free(&streams[i]);
+		if (output != OUTPUT_TEXT)
+		{
+			stat_record(&(struct record){ .type = "stream_summary", .stream = streams[i].id, .interval = te - tb,
+				.bytes = streams[i].total_recvd, .total_bytes = streams[i].total_recvd, });
+			continue;
+		}
+		printf("stream #%i: ", streams[i].id);
+		printbw(te - tb, streams[i].total_recvd, "avg:");
+		printsz(streams[i].total_recvd, "size:");
+		printf("\n");
+	}
+	
+	close(ep);
+	free(streams);
+}
+
+// ring storage: when size is a multiple of the page size, a memfd is
+// mapped twice back to back ("magic ring") so that [ptr, ptr + size)
+// is always contiguous, optionally on hugepages
+
+static char* ring_mirror (int fd, size_t size, size_t align)
+{
+	// reserve address space, aligned for hugepages
+	char* area = (char*)mmap(NULL, 2 * size + align, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (area == MAP_FAILED)
+		return NULL;
+	char* base = align? (char*)(((uintptr_t)area + align - 1) & ~(uintptr_t)(align - 1)): area;
+	if (base > area)
+		munmap(area, base - area);
+	if (align && base + 2 * size < area + 2 * size + align)
+		munmap(base + 2 * size, area + 2 * size + align - (base + 2 * size));
+	
+	if (   mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+	    || mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+	{
+		munmap(base, 2 * size);
+		return NULL;
+	}
+	return base;
+}
+
+char* ring_map (size_t size, int* mirrored)
+{
+	static int warned = 0;
+	char* buf = NULL;
+	int fd;
+	
+	if (size % sysconf(_SC_PAGESIZE) == 0)
+	{
+		if (hugepages)
+		{
+			size_t hugesz = 2 << 20;
+			if (   size % hugesz == 0
+			    && (fd = memfd_create("tcpechotester", MFD_CLOEXEC | MFD_HUGETLB)) != -1)
+			{
+				if (ftruncate(fd, size) == 0)
+					buf = ring_mirror(fd, size, hugesz);
+				close(fd);
+			}
+			if (!buf && !warned)
+			{
+				warned = 1;
+				fprintf(stderr, "no hugepages for %zu bytes ring, using normal pages\n", size);
+			}
+		}
+		if (!buf && (fd = memfd_create("tcpechotester", MFD_CLOEXEC)) != -1)
+		{
+			if (ftruncate(fd, size) == 0)
+				buf = ring_mirror(fd, size, 0);
+			close(fd);
+		}
+	}
+	
+	if ((*mirrored = buf != NULL))
+		return buf;
+	
+	// small ring, transfers are split at wrap
+	if ((buf = (char*)malloc(size)) == NULL)
+	{
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	return buf;
+}
+
+void ring_unmap (char* buf, size_t size, int mirrored)
+{
+	if (mirrored)
+		munmap(buf, 2 * size);
+	else
+		free(buf);
+}
+
+// request/response (-q n,m): the client sends a n-byte request and waits for
+// the whole m-byte response before sending the next one
+
+void showrr (long long trans_in_loop)
+{
+	if (output != OUTPUT_TEXT)
+	{
+		stat_record(&(struct record){ .type = "interval", .stream = -1, .interval = te - ti,
+			.bytes = data_in_loop, .total_bytes = data_overall,
+			.count = trans_in_loop, .total_count = rr_trans, .lat = &lat_interval, });
+		hist_reset(&lat_interval);
+		stat_snapshot = 0;
+		ti = te;
+		data_in_loop = 0;
+		return;
+	}
+	
+	printf("\r[avg:%g tps][now:%g tps][trans:%lli]", rr_trans * 1e9 / (te - tb), trans_in_loop * 1e9 / (te - ti), rr_trans);
+	printhist(&lat_interval);
+	hist_reset(&lat_interval);
+	printf("-----");
+	stat_endline();
+	ti = te;
+}
+
+void rr_summary (void)
+{
+	printf("%lli transactions (%i/%i bytes) [avg:%g tps]\n", rr_trans, rr_req, rr_resp, rr_trans * 1e9 / (te - tb));
+	lat_summary();
+}
+
+void echorr (int sock, int datasize)
+{
+	struct stream s;
+	struct pollfd pollfd [2] = { { .fd = sock, }, { .fd = statfd, .events = POLLIN, }, };
+	long long trans_in_loop = 0;
+	
+	setcntl(sock, F_SETFL, O_NONBLOCK, "O_NONBLOCK");
+	stream_init(&s, sock, 0, datasize, 0);
+	
+	if (!rr_trans)
+		tb = ti = nowns();
+	
+	while (!datasize || s.total_sent < datasize)
+	{
+		long long start = nowns();
+		ssize_t tosend = rr_req;
+		ssize_t torecv = rr_resp;
+		
+		while (torecv)
+		{
+			pollfd[0].events = POLLIN;
+			if (tosend)
+				pollfd[0].events |= POLLOUT;
+			if (poll(pollfd, 2, 1000 /*ms*/) == -1)
+			{
+				perror("poll");
+				exit(EXIT_FAILURE);
+			}
+			
+			if (pollfd[0].revents & POLLOUT)
+			{
+				// bufout holds the pattern twice
+				ssize_t size = tosend < buflen? tosend: buflen;
+				ssize_t ret = write(sock, stream_txdata(&s, size), size);
+				if (ret == -1 && errno != EAGAIN)
+				{
+					perror("write");
+					exit(EXIT_FAILURE);
+				}
+				if (ret > 0)
+				{
+					tosend -= ret;
+					s.total_sent += ret;
+					s.ptr_to_send = (s.ptr_to_send + ret) & (buflen - 1);
+				}
+			}
+			
+			if (pollfd[0].revents & (POLLIN | POLLHUP | POLLERR))
+			{
+				ssize_t ret = read(sock, bufin, torecv < buflen? torecv: buflen);
+				if (ret == 0)
+				{
+					fprintf(stderr, "\npeer has closed\n");
+					goto out;
+				}
+				if (ret == -1 && errno != EAGAIN)
+				{
+					perror("read");
+					exit(EXIT_FAILURE);
+				}
+				if (ret > 0)
+				{
+					// an echo can be checked, a response from "-R -q n,m" cannot
+					if (rr_resp == rr_req)
+						stream_check(&s, bufin, ret);
+					torecv -= ret;
+					data_overall += ret;
+					data_in_loop += ret;
+				}
+			}
+			
+			// drained here, a pending tick would keep poll() from waiting
+			if ((pollfd[1].revents & POLLIN) && stat_tick())
+			{
+				showrr(trans_in_loop);
+				trans_in_loop = 0;
+			}
+		}
+		
+		long long lat = nowns() - start;
+		hist_add(&lat_interval, lat);
+		hist_add(&lat_overall, lat);
+		rr_trans++;
+		trans_in_loop++;
+	}
+	
+out:
+	te = nowns();
+	showrr(trans_in_loop);
+	stream_free(&s);
+	my_close(sock, trans_in_loop * (rr_req + rr_resp));
+}
+
+// connection rate (-x n): connect, request/response (-q, default 1 byte),
+// close, and again, with -P connections in flight
+
+enum { CRR_CONNECTING, CRR_REQUEST, CRR_CLOSING };
+
+struct crr
+{
+	int fd;
+	int state;
+	uint32_t events;
+	long long t; // ns, start of current phase
+	ssize_t sent;
+	ssize_t recvd;
+};
+
+struct hist crr_connect; // connect() to established
+struct hist crr_first;   // request to first response byte
+struct hist crr_close;   // shutdown() to peer's FIN
+
+// returns 0 when connect() failed right away
+static int crr_start (struct crr* c, int ep, int nodelay)
+{
+	if ((c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) == -1)
+	{
+		perror("socket()");
+		exit(EXIT_FAILURE);
+	}
+	if (nodelay)
+		setflag(c->fd, -1, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+	c->state = CRR_CONNECTING;
+	c->t = nowns();
+	const struct sockaddr_in* server = my_nextaddr(c->fd);
+	if (!server || (connect(c->fd, (const struct sockaddr*)server, sizeof(*server)) == -1 && errno != EINPROGRESS))
+	{
+		close(c->fd);
+		c->fd = -1;
+		return 0;
+	}
+	c->events = EPOLLOUT;
+	struct epoll_event ev = { .events = c->events, .data.ptr = c, };
+	if (epoll_ctl(ep, EPOLL_CTL_ADD, c->fd, &ev) == -1)
+	{
+		perror("epoll_ctl");
+		exit(EXIT_FAILURE);
+	}
+	return 1;
+}
+
+// returns 1 to continue, 0 when done, -1 on failure
+static int crr_io (struct crr* c, uint32_t events)
+{
+	ssize_t reqlen = rr_req? rr_req: 1;
+	ssize_t resplen = rr_resp? rr_resp: 1;
+	long long now = nowns();
+	ssize_t ret;
+	
+	switch (c->state)
+	{
+	case CRR_CONNECTING:
+	{
+		int err = 0;
+		socklen_t len = sizeof(err);
+		if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err)
+			return -1;
+		hist_add(&crr_connect, now - c->t);
+		c->state = CRR_REQUEST;
+		c->t = now;
+		c->sent = 0;
+		c->recvd = 0;
+		events = EPOLLOUT;
+	}
+	// fall through
+	case CRR_REQUEST:
+		if ((events & EPOLLOUT) && c->sent < reqlen)
+		{
+			// bufout holds the pattern twice
+			ret = write(c->fd, bufout + (c->sent & (buflen - 1)), reqlen - c->sent < buflen? reqlen - c->sent: buflen);
+			if (ret == -1 && errno != EAGAIN)
+				return -1;
+			if (ret > 0)
+				c->sent += ret;
+		}
+		if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+		{
+			ret = read(c->fd, bufin, resplen - c->recvd < buflen? resplen - c->recvd: buflen);
+			if (ret == 0 || (ret == -1 && errno != EAGAIN))
+				return -1;
+			if (ret > 0)
+			{
+				if (!c->recvd)
+					hist_add(&crr_first, now - c->t);
+				if (resplen == reqlen && memcmp(bufin, bufout + (c->recvd & (buflen - 1)), ret) != 0)
+				{
+					fprintf(stderr, "\ndata differ (response offset %zi)\n", c->recvd);
+					exit(EXIT_FAILURE);
+				}
+				c->recvd += ret;
+			}
+		}
+		if (c->recvd == resplen)
+		{
+			// close, wait for peer's
+			shutdown(c->fd, SHUT_WR);
+			c->state = CRR_CLOSING;
+			c->t = nowns();
+		}
+		return 1;
+		
+	case CRR_CLOSING:
+		ret = read(c->fd, bufin, buflen);
+		if (ret == 0)
+		{
+			hist_add(&crr_close, now - c->t);
+			return 0;
+		}
+		return ret > 0 || errno == EAGAIN? 1: -1;
+	}
+	
+	return -1;
+}
+
+static void crr_update (struct crr* c, int ep)
+{
+	uint32_t events = EPOLLIN;
+	if (c->state == CRR_REQUEST && c->sent < (rr_req? rr_req: 1))
+		events |= EPOLLOUT;
+	if (events != c->events)
+	{
+		struct epoll_event ev = { .events = events, .data.ptr = c, };
+		if (epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev) == -1)
+		{
+			perror("epoll_ctl");
+			exit(EXIT_FAILURE);
+		}
+		c->events = events;
+	}
+}
+
+static void crr_show (long long done, long long done_in_loop, long long failed)
+{
+	if (output != OUTPUT_TEXT)
+	{
+		stat_record(&(struct record){ .type = "interval", .stream = -1, .interval = te - ti,
+			.count = done_in_loop, .total_count = done, .failed = failed, });
+		stat_snapshot = 0;
+		ti = te;
+		return;
+	}
+	printf("\r[avg:%g cps][now:%g cps][conns:%lli][failed:%lli]-----", done * 1e9 / (te - tb), done_in_loop * 1e9 / (te - ti), done, failed);
+	stat_endline();
+	ti = te;
+}
+
+void echocrr (int inflight, long long count, int nodelay)
+{
+	long long started = 0;
+	long long done = 0;
+	long long failed = 0;
+	long long done_in_loop = 0;
+	int running = 0;
+	
+	struct crr* conns = (struct crr*)malloc(inflight * sizeof(struct crr));
+	if (!conns)
+	{
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < inflight; i++)
+		conns[i].fd = -1;
+	
+	int ep = epoll_create1(0);
+	if (ep == -1)
+	{
+		perror("epoll_create1");
+		exit(EXIT_FAILURE);
+	}
+	
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &statfd, };
+	if (statfd >= 0 && epoll_ctl(ep, EPOLL_CTL_ADD, statfd, &ev) == -1)
+	{
+		perror("epoll_ctl");
+		exit(EXIT_FAILURE);
+	}
+	
+	tb = ti = nowns();
+	
+	while (running || !count || started < count)
+	{
+		// refill free slots, a refused connect() waits for next round
+		for (int i = 0; i < inflight && (!count || started < count); i++)
+			if (conns[i].fd == -1)
+			{
+				started++;
+				if (crr_start(&conns[i], ep, nodelay))
+					running++;
+				else
+				{
+					failed++;
+					break;
+				}
+			}
+		
+		struct epoll_event evs[64];
+		int nev = epoll_wait(ep, evs, sizeof(evs) / sizeof(evs[0]), 1000 /*ms*/);
+		if (nev == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			exit(EXIT_FAILURE);
+		}
+		
+		for (int e = 0; e < nev; e++)
+		{
+			if (evs[e].data.ptr == &statfd)
+			{
+				if (stat_tick())
+				{
+					crr_show(done, done_in_loop, failed);
+					done_in_loop = 0;
+				}
+				continue;
+			}
+			
+			struct crr* c = (struct crr*)evs[e].data.ptr;
+			int ret = crr_io(c, evs[e].events);
+			if (ret == 1)
+			{
+				crr_update(c, ep);
+				continue;
+			}
+			if (ret == 0)
+			{
+				done++;
+				done_in_loop++;
+			}
+			else
+				failed++;
+			epoll_ctl(ep, EPOLL_CTL_DEL, c->fd, NULL);
+			close(c->fd);
+			c->fd = -1;
+			running--;
+		}
+	}
+	
+	te = nowns();
+	crr_show(done, done_in_loop, failed);
+	if (output != OUTPUT_TEXT)
+	{
+		stat_record(&(struct record){ .type = "connect", .stream = -1, .interval = te - tb,
+			.count = done, .total_count = done, .failed = failed, .lat = &crr_connect, });
+		stat_record(&(struct record){ .type = "first_byte", .stream = -1, .interval = te - tb,
+			.count = done, .total_count = done, .failed = failed, .lat = &crr_first, });
+		stat_record(&(struct record){ .type = "close", .stream = -1, .interval = te - tb,
+			.count = done, .total_count = done, .failed = failed, .lat = &crr_close, });
+	}
+	else
+	{
+		printf("\n%lli connections, %lli failed\n", done, failed);
+		printf("connect:    "); printhist(&crr_connect); printf("\n");
+		printf("first byte: "); printhist(&crr_first); printf("\n");
+		printf("close:      "); printhist(&crr_close); printf("\n");
+	}
+	
+	close(ep);
+	free(conns);
+}
+
+// responder ring buffer state
+struct ring
+{
+	char* buf;
+	int size; // power of 2
+	int mirrored;
+	int ptr_to_send;
+	int ptr_for_recv;
+	size_t inbuf;
+};
+
+void ring_init (struct ring* r, char* buf, int size, int mirrored)
+{
+	r->buf = buf;
+	r->size = size;
+	r->mirrored = mirrored;
+	r->ptr_to_send = 0;
+	r->ptr_for_recv = 0;
+	r->inbuf = 0;
+}
+
+// can read: with seqpacket, a record is read whole into an empty ring
+int ring_room (const struct ring* r)
+{
+	return transport == TRANSPORT_SEQPACKET? !r->inbuf: r->inbuf < (size_t)r->size;
+}
+
+// read into the ring, returns read()'s value
+ssize_t ring_recv (int sock, struct ring* r)
+{
+	if (!r->inbuf)
+		r->ptr_for_recv = r->ptr_to_send = 0;
+	ssize_t maxrecv = r->size - r->inbuf;
+	if (!r->mirrored && maxrecv > r->size - r->ptr_for_recv)
+		maxrecv = r->size - r->ptr_for_recv;
+	ssize_t ret = read(sock, r->buf + r->ptr_for_recv, maxrecv);
+	if (ret > 0)
+	{
+		r->inbuf += ret;
+		r->ptr_for_recv = (r->ptr_for_recv + ret) & (r->size - 1);
+	}
+	return ret;
+}
+
+// write from the ring, returns write()'s value
+ssize_t ring_send (int sock, struct ring* r)
+{
+	ssize_t maxsend = r->inbuf;
+	if (!r->mirrored && maxsend > r->size - r->ptr_to_send)
+		maxsend = r->size - r->ptr_to_send;
+	ssize_t ret = write(sock, r->buf + r->ptr_to_send, maxsend);
+	if (ret > 0)
+	{
+		r->inbuf -= ret;
+		r->ptr_to_send = (r->ptr_to_send + ret) & (r->size - 1);
+	}
+	return ret;
+}
+
+// zero-copy responder state: data goes sock -> pipe -> sock with splice()
+struct splicer
+{
+	int pipe [2];
+	size_t inpipe;
+	size_t pipesz;
+};
+
+// returns 0 when no pipe can be made
+int splicer_init (struct splicer* sp)
+{
+	if (pipe2(sp->pipe, O_NONBLOCK | O_CLOEXEC) == -1)
+	{
+		perror("pipe2");
+		return 0;
+	}
+	// bigger pipe, up to /proc/sys/fs/pipe-max-size
+	fcntl(sp->pipe[1], F_SETPIPE_SZ, SPLICE_PIPESZ);
+	int sz = fcntl(sp->pipe[1], F_GETPIPE_SZ);
+	sp->pipesz = sz > 0? sz: 65536;
+	sp->inpipe = 0;
+	return 1;
+}
+
+void splicer_close (struct splicer* sp)
+{
+	close(sp->pipe[0]);
+	close(sp->pipe[1]);
+}
+
+// returns splice()'s value
+ssize_t splicer_recv (int sock, struct splicer* sp)
+{
+	ssize_t ret = splice(sock, NULL, sp->pipe[1], NULL, sp->pipesz - sp->inpipe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (ret > 0)
+		sp->inpipe += ret;
+	return ret;
+}
+
+// returns splice()'s value
+ssize_t splicer_send (int sock, struct splicer* sp)
+{
+	ssize_t ret = splice(sp->pipe[0], NULL, sock, NULL, sp->inpipe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (ret > 0)
+		sp->inpipe -= ret;
+	return ret;
+}
+
+// returns 0 when splice() is not possible with sock (caller falls back to copy)
+int echoresponder_splice (int sock)
+{
+	struct splicer sp;
+	struct pollfd pollfd [2] = { { .fd = sock, }, { .fd = statfd, .events = POLLIN, }, };
+	
+	if (!splicer_init(&sp))
+		return 0;
+	
+	tb = ti = nowns();
+	
+	while (1)
+	{
+		pollfd[0].events =  0;
+		if (sp.inpipe < sp.pipesz) pollfd[0].events |= POLLIN;
+		if (sp.inpipe) pollfd[0].events |= POLLOUT;
+		int ret = poll(pollfd, 2, 1000 /*ms*/);
+		if (ret == -1)
+		{
+			perror("poll");
+			break;
+		}
+
+		if (pollfd[0].revents & POLLIN)
+		{
+			ssize_t ret = splicer_recv(sock, &sp);
+			if (ret == -1 && errno == EINVAL && !data_overall)
+			{
+				fprintf(stderr, "splice() not supported, copying\n");
+				splicer_close(&sp);
+				return 0;
+			}
+			if (ret == -1 && errno != EAGAIN)
+			{
+				perror("splice(in)");
+				break;
+			}
+			if (ret == 0)
+			{
+				fprintf(stderr, "peer has closed\n");
+				break;
+			}
+		}
+		
+		if (pollfd[0].revents & POLLOUT)
+		{
+			ssize_t ret = splicer_send(sock, &sp);
+			if (ret == -1 && errno != EAGAIN)
+			{
+				perror("splice(out)");
+				break;
+			}
+			if (ret > 0)
+			{
+				data_in_loop += ret;
+				data_overall += ret;
+			}
+		}
+		
+		if (pollfd[0].revents & ~(POLLIN | POLLOUT))
+		{
+			fprintf(stderr, "unregular event occured\n");
+			break;
+		}
+		
+		if ((pollfd[1].revents & POLLIN) && stat_tick())
+			showbw(NULL, 0);
+	}
+	
+	splicer_close(&sp);
+	return 1;
+}
+
+// responder side of -q n,m: m bytes from bufout are replied per n bytes received
+// (n == m is a plain echo)
+
+#define REPLY_IOV 64
+struct replier
+{
+	int inreq; // received bytes of the current request
+	long long toreply;
+	int ptr_to_send;
+};
+
+int replying (void)
+{
+	return rr_req && rr_resp != rr_req;
+}
+
+ssize_t replier_recv (int sock, struct replier* rp, char* buf)
+{
+	ssize_t ret = read(sock, buf, buflen);
+	if (ret > 0)
+	{
+		rp->inreq += ret;
+		rp->toreply += (long long)(rp->inreq / rr_req) * rr_resp;
+		rp->inreq %= rr_req;
+	}
+	return ret;
+}
+
+ssize_t replier_send (int sock, struct replier* rp)
+{
+	// a response in one writev(), buflen-sized pieces would each be a
+	// segment for Nagle to hold back; bufout holds the pattern twice, so
+	// every piece starts at the same offset
+	struct iovec iov [REPLY_IOV];
+	int n = 0;
+	for (long long left = rp->toreply; left > 0 && n < REPLY_IOV; left -= buflen)
+	{
+		iov[n].iov_base = bufout + rp->ptr_to_send;
+		iov[n++].iov_len = left < buflen? left: buflen;
+	}
+	ssize_t ret = writev(sock, iov, n);
+	if (ret > 0)
+	{
+		rp->toreply -= ret;
+		rp->ptr_to_send = (rp->ptr_to_send + ret) & (buflen - 1);
+	}
+	return ret;
+}
+
+// returns the bytes moved both ways
+long long echoresponder_reply (int sock)
+{
+	struct replier rp = { 0, 0, 0, };
+	struct pollfd pollfd = { .fd = sock, };
+	long long moved = 0;
+	
+	while (1)
+	{
+		pollfd.events = 0;
+		if (rp.toreply < buflen) pollfd.events |= POLLIN;
+		if (rp.toreply) pollfd.events |= POLLOUT;
+		int ret = tty_poll(&pollfd, 1);
+		if (ret == -1)
+		{
+			perror("poll");
+			break;
+		}
+		
+		if (pollfd.revents & POLLIN)
+		{
+			ssize_t ret = replier_recv(sock, &rp, bufin);
+			if (ret == -1 && errno != EAGAIN)
+			{
+				perror("read");
+				break;
+			}
+			if (ret == 0)
+			{
+				fprintf(stderr, "peer has closed\n");
+				break;
+			}
+			if (ret > 0)
+				moved += ret;
+		}
+		
+		if (pollfd.revents & POLLOUT)
+		{
+			ssize_t ret = replier_send(sock, &rp);
+			if (ret == -1 && errno != EAGAIN)
+			{
+				perror("write");
+				break;
+			}
+			if (ret > 0)
+				moved += ret;
+		}
+		
+		if (pollfd.revents & ~(POLLIN | POLLOUT))
+		{
+			fprintf(stderr, "unregular event occured\n");
+			break;
+		}
+	}
+	return moved;
+}
+
+void echoresponder (int sock)
+{
+	if (replying())
+	{
+		setcntl(sock, F_SETFL, O_NONBLOCK, "O_NONBLOCK");
+		my_close(sock, echoresponder_reply(sock));
+		return;
+	}
+	
+	// what is echoed was received
+	long long echoed = data_overall;
+#if URING
+	if (engine == ENGINE_URING && echouring(sock, MODE_RESPONDER, NULL))
+	{
+		my_close(sock, 2 * (data_overall - echoed));
+		return;
+	}
+#endif
+	
+	setcntl(sock, F_SETFL, O_NONBLOCK, "O_NONBLOCK");
+	
+	if (zerocopy && echoresponder_splice(sock))
+	{
+		my_close(sock, 2 * (data_overall - echoed));
+		return;
+	}
+	
+	long long moved = 0;
+	struct ring r;
+	struct pollfd pollfd = { .fd = sock, .events = POLLIN | POLLOUT, };
+	
+	ring_init(&r, bufin, buflen, bufin_mirrored);
+	
+	while (1)
+	{
+		pollfd.events =  0;
+		if (ring_room(&r)) pollfd.events |= POLLIN;
+		if (r.inbuf) pollfd.events |= POLLOUT;
+		int ret = tty_poll(&pollfd, 1);
+		if (ret == -1)
+		{
+			perror("poll");
+			close(sock);
+			return;
+		}
+
+		if (pollfd.revents & POLLIN)
+		{
+			ssize_t ret = ring_recv(sock, &r);
+			if (ret == -1 && errno != EAGAIN)
+			{
+				perror("read");
+				break;
+			}
+			if (ret == 0)
+			{
+				fprintf(stderr, "peer has closed\n");
+				break;
+			}
+			if (ret > 0)
+				moved += ret;
+		}
+		
+		if (pollfd.revents & POLLOUT)
+		{
+			ssize_t ret = ring_send(sock, &r);
+			if (ret == -1)
+			{
+				perror("write");
+				break;
+			}
+			moved += ret;
+		}
+		
+		if (pollfd.revents & ~(POLLIN | POLLOUT))
+		{
+			fprintf(stderr, "unregular event occured\n");
+			break;
+		}
+	}
+
+	my_close(sock, moved);
+}
+
+void echosink (int sock)
+{
+	// verification of -k data
+	struct stream s;
+	stream_init(&s, sock, 0, 0, 0);
+	long long received = data_overall;
+	
+#if URING
+	if (engine == ENGINE_URING && echouring(sock, MODE_SINK, &s))
+	{
+		my_close(sock, data_overall - received);
+		return;
+	}
+#endif
+	
+	struct pollfd pollfd [2] = { { .fd = sock, .events = POLLIN, }, { .fd = statfd, .events = POLLIN, }, };
+	struct zcrx z;
+	int zc = zerocopy && zcrx_init(&z, sock);
+	
+	tb = ti = nowns();
+
+	while (1)
+	{
+		int ret = poll(pollfd, 2, 1000 /*ms*/);
+		if (ret == -1)
+		{
+			perror("poll");
+			close(sock);
+			return;
+		}
+
+		// a fifo's writer leaving is POLLHUP only
+		if (pollfd[0].revents & (POLLIN | POLLHUP))
+		{
+			ssize_t ret = zc? zcrx_recv(sock, &z, bufin, buflen): read(sock, bufin, buflen);
+			if (ret == -1)
+			{
 				perror("read");
 				break;
 			}
-			if (ret == 0)
+			if (ret == 0)
+			{
+				fprintf(stderr, "peer has closed\n");
+				break;
+			}
+			if (keyed)
+				stream_check(&s, bufin, ret);
+			data_in_loop += ret;
+			data_overall += ret;
+			if (zc)
+			{
+				zcstats.completed = z.mapped + z.copied;
+				zcstats.copied = z.copied;
+			}
+		}
+		
+		if (pollfd[0].revents & ~(POLLIN | POLLOUT | POLLHUP))
+		{
+			fprintf(stderr, "unregular event occured\n");
+			break;
+		}
+		
+		if ((pollfd[1].revents & POLLIN) && stat_tick())
+			showbw(NULL, 0);
+	}
+
+	if (zc)
+	{
+		printf("\n");
+		zcrx_summary(&z);
+		zcrx_close(&z);
+	}
+	stream_free(&s);
+	my_close(sock, data_overall - received);
+}
+
+void echosource (int sock)
+{
+	long long sent = data_overall;
+#if URING
+	if (engine == ENGINE_URING && echouring(sock, MODE_SOURCE, NULL))
+	{
+		my_close(sock, data_overall - sent);
+		return;
+	}
+#endif
+	
+	setcntl(sock, F_SETFL, O_NONBLOCK, "O_NONBLOCK");
+	
+	struct pollfd pollfd [2] = { { .fd = sock, .events = POLLOUT, }, { .fd = statfd, .events = POLLIN, }, };
+	int zc = zerocopy && zc_enable(sock);
+	const char* txbuf = zc? zc_region(): bufout;
+	int txlen = zc? zclen: buflen;
+	int ptr_to_send = 0;
+	struct stream s; // -k data
+	stream_init(&s, sock, 0, 0, 0);
+	
+	tb = ti = nowns();
+
+	while (1)
+	{
+		int ret = poll(pollfd, 2, 1000 /*ms*/);
+		if (ret == -1)
+		{
+			perror("poll");
+			close(sock);
+			return;
+		}
+
+		if (zc && (pollfd[0].revents & POLLERR))
+		{
+			zc_reap(sock);
+			pollfd[0].revents &= ~POLLERR;
+		}
+		
+		if (pollfd[0].revents & POLLOUT)
+		{
+			// txbuf holds the pattern twice
+			ssize_t size = txlen;
+			ssize_t ret;
+			if (zc)
+			{
+				ret = send(sock, txbuf + ptr_to_send, size, MSG_ZEROCOPY);
+				if (ret == -1 && errno == ENOBUFS)
+				{
+					// too many pending notifications
+					zc_reap(sock);
+					continue;
+				}
+				if (ret >= 0)
+					zcstats.sends++;
+			}
+			else
+				ret = write(sock, keyed? stream_txdata(&s, size): txbuf + ptr_to_send, size);
+			if (ret == -1)
+			{
+				perror("write");
+				break;
+			}
+			if (ret == 0)
+			{
+				fprintf(stderr, "peer has closed\n");
+				break;
+			}
+			data_in_loop += ret;
+			data_overall += ret;
+			ptr_to_send = (ptr_to_send + ret) & (txlen - 1);
+			s.total_sent += ret;
+		}
+		
+		if (pollfd[0].revents & ~(POLLIN | POLLOUT))
+		{
+			fprintf(stderr, "unregular event occured\n");
+			break;
+		}
+
+		if ((pollfd[1].revents & POLLIN) && stat_tick())
+			showbw(NULL, 0);
+	}
+
+	if (zc)
+		zc_reap(sock);
+	stream_free(&s);
+	my_close(sock, data_overall - sent);
+}
+
+// UDP (-t udp): sequence-numbered datagrams, batched with sendmmsg/recvmmsg,
+// responder and sink are servers (bound to -p), comparator and source need -d
+
+#define UDP_BATCH 64
+#define UDP_WINDOW (1<<16) // duplicate detection, in datagrams
+#define UDP_SOURCES 16     // sequence spaces followed at once by a sink
+
+int dgsize = 1024;     // -g
+long long udprate = 0; // -B, bits/s, 0: unlimited
+
+struct dgram
+{
+	uint64_t seq; // big endian
+	int64_t t;    // sender's CLOCK_MONOTONIC ns, big endian
+};
+
+// one sender's sequence space
+struct seqwin
+{
+	struct sockaddr_in from;
+	int started;
+	uint64_t base;      // first sequence seen
+	uint64_t maxseq;
+	long long transit;  // last one, ns
+	uint64_t win [UDP_WINDOW / 64];
+};
+
+struct seqstats
+{
+	long long received; // unique
+	long long dups;
+	long long reordered;
+	long long bad;      // truncated or corrupted
+	long long closed;   // expected in the sequence spaces already over
+	double jitter;      // ns, RFC 3550
+	long long iexpected, ireceived; // at the last report
+	long long ipackets; // received in interval, duplicates included
+	int nwins;
+	struct seqwin wins [UDP_SOURCES];
+};
+
+#define SEQ_BIT(w, s) ((w)->win[((s) & (UDP_WINDOW - 1)) / 64] & (1ULL << ((s) & 63)))
+#define SEQ_SET(w, s) ((w)->win[((s) & (UDP_WINDOW - 1)) / 64] |= (1ULL << ((s) & 63)))
+#define SEQ_CLR(w, s) ((w)->win[((s) & (UDP_WINDOW - 1)) / 64] &= ~(1ULL << ((s) & 63)))
+
+static long long seq_span (const struct seqwin* w)
+{
+	return w->started? (long long)(w->maxseq - w->base + 1): 0;
+}
+
+static long long seq_expected (const struct seqstats* st)
+{
+	long long expected = st->closed;
+	for (int i = 0; i < st->nwins; i++)
+		expected += seq_span(&st->wins[i]);
+	return expected;
+}
+
+// sequence space of a sender (NULL: ours, echoed back), a new one replaces
+// the oldest when all are taken
+static struct seqwin* seq_window (struct seqstats* st, const struct sockaddr_in* from)
+{
+	static const struct sockaddr_in none;
+	if (!from)
+		from = &none;
+	for (int i = 0; i < st->nwins; i++)
+		if (   st->wins[i].from.sin_addr.s_addr == from->sin_addr.s_addr
+		    && st->wins[i].from.sin_port == from->sin_port)
+			return &st->wins[i];
+	
+	struct seqwin* w;
+	if (st->nwins < UDP_SOURCES)
+		w = &st->wins[st->nwins++];
+	else
+	{
+		memmove(&st->wins[0], &st->wins[1], (UDP_SOURCES - 1) * sizeof(struct seqwin));
+		w = &st->wins[UDP_SOURCES - 1];
+		st->closed += seq_span(w);
+	}
+	memset(w, 0, sizeof(*w));
+	w->from = *from;
+	return w;
+}
+
+// one received datagram, echo: sent by us (payload from bufout, rtt)
+static void seq_account (struct seqstats* st, const struct sockaddr_in* from, const char* buf, ssize_t len, int trunc, long long now, int echo)
+{
+	struct dgram h;
+	size_t plen = len - sizeof(h);
+	
+	st->ipackets++;
+	data_in_loop += len;
+	data_overall += len;
+	if (trunc || len < (ssize_t)sizeof(h))
+	{
+		st->bad++;
+		return;
+	}
+	memcpy(&h, buf, sizeof(h));
+	uint64_t seq = be64toh(h.seq);
+	long long t = be64toh(h.t);
+	
+	if (   (keyed && pattern_check(buf + sizeof(h), seq * plen, plen) >= 0)
+	    || (!keyed && echo && memcmp(buf + sizeof(h), bufout + (seq & (buflen - 1)), plen) != 0))
+	{
+		st->bad++;
+		return;
+	}
+	
+	struct seqwin* w = seq_window(st, from);
+	if (w->started && seq == 0)
+	{
+		// the sender has started again (new -S run from the same address)
+		st->closed += seq_span(w);
+		w->started = 0;
+	}
+	
+	if (!w->started || seq > w->maxseq)
+	{
+		uint64_t next = w->started? w->maxseq + 1: seq;
+		if (!w->started)
+			w->base = seq;
+		if (!w->started || seq - next >= UDP_WINDOW)
+			memset(w->win, 0, sizeof(w->win));
+		else
+			for (uint64_t s = next; s < seq; s++)
+				SEQ_CLR(w, s);
+		w->maxseq = seq;
+		w->started = 1;
+	}
+	else if (w->maxseq - seq >= UDP_WINDOW || seq < w->base)
+	{
+		// too old to tell, counted as late
+		st->reordered++;
+		st->received++;
+		return;
+	}
+	else if (SEQ_BIT(w, seq))
+	{
+		st->dups++;
+		return;
+	}
+	else
+		st->reordered++;
+	SEQ_SET(w, seq);
+	st->received++;
+	
+	long long transit = now - t;
+	if (w->transit)
+	{
+		long long d = transit - w->transit;
+		st->jitter += ((d < 0? -d: d) - st->jitter) / 16;
+	}
+	w->transit = transit;
+	if (echo)
+	{
+		hist_add(&lat_interval, transit);
+		hist_add(&lat_overall, transit);
+	}
+}
+
+// st: receiving side (NULL for source), isent: datagrams sent in interval
+static void udp_show (struct seqstats* st, long long isent, long long sent)
+{
+	long long ilost = 0, lost = 0;
+	if (st)
+	{
+		lost = seq_expected(st) - st->received;
+		ilost = lost - (st->iexpected - st->ireceived);
+	}
+	
+	if (output != OUTPUT_TEXT)
+	{
+		stat_record(&(struct record){ .type = "interval", .stream = -1, .interval = te - ti,
+			.bytes = data_in_loop, .total_bytes = data_overall,
+			.count = st? st->ipackets: isent, .total_count = st? st->received: sent,
+			.failed = ilost, .lat = &lat_interval, });
+		stat_snapshot = 0;
+	}
+	else
+	{
+		printf("\r");
+		if (sent)
+			printf("[tx:%g pps]", isent * 1e9 / (te - ti));
+		if (st)
+		{
+			printf("[rx:%g pps]", st->ipackets * 1e9 / (te - ti));
+			printbw(te - ti, data_in_loop, "rx:");
+			printf("[lost:%lli][dup:%lli][reord:%lli][bad:%lli]", lost, st->dups, st->reordered, st->bad);
+			printns(st->jitter, "jitter:");
+			if (lat_interval.count)
+				printhist(&lat_interval);
+		}
+		else
+			printbw(te - ti, data_in_loop, NULL);
+		printf("-----");
+		stat_endline();
+	}
+	
+	if (st)
+	{
+		st->iexpected = seq_expected(st);
+		st->ireceived = st->received;
+		st->ipackets = 0;
+	}
+	hist_reset(&lat_interval);
+	data_in_loop = 0;
+	ti = te;
+}
+
+static void udp_summary (struct seqstats* st, long long sent)
+{
+	// an echo is lost when it did not come back
+	long long expected = sent? sent: st? seq_expected(st): 0;
+	long long lost = st? expected - st->received: 0;
+	
+	if (output != OUTPUT_TEXT)
+	{
+		stat_record(&(struct record){ .type = "summary", .stream = -1, .interval = te - tb,
+			.bytes = data_overall, .total_bytes = data_overall,
+			.count = sent, .total_count = st? st->received: sent,
+			.failed = lost, .lat = &lat_overall, });
+		return;
+	}
+	printf("\n");
+	if (sent)
+		printf("%lli datagrams (%i bytes) sent%s", sent, dgsize, st? ", ": "");
+	if (st)
+	{
+		printf("%lli received, %lli lost (%g%%), %lli duplicated, %lli reordered, %lli bad ",
+			st->received, lost, expected? lost * 100.0 / expected: 0,
+			st->dups, st->reordered, st->bad);
+		printns(st->jitter, "jitter:");
+	}
+	printf("\n");
+	if (lat_overall.count)
+		lat_summary();
+}
+
+static void udp_bufsize (int sock)
+{
+	// best effort, capped by net.core.[rw]mem_max
+	int size = 4 << 20;
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+}
+
+static struct mmsghdr* udp_rxinit (char** pool, struct iovec* iov, struct sockaddr_in* names)
+{
+	static struct mmsghdr msgs [UDP_BATCH];
+	if ((*pool = (char*)malloc(UDP_BATCH * (size_t)dgsize)) == NULL)
+	{
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < UDP_BATCH; i++)
+	{
+		iov[i].iov_base = *pool + i * (size_t)dgsize;
+		iov[i].iov_len = dgsize;
+		msgs[i].msg_hdr = (struct msghdr){ .msg_iov = &iov[i], .msg_iovlen = 1, };
+		if (names)
+		{
+			msgs[i].msg_hdr.msg_name = &names[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(names[i]);
+		}
+	}
+	return msgs;
+}
+
+// comparator (echo) and source
+void udp_sender (int sock, int echo, long long datasize)
+{
+	size_t plen = dgsize - sizeof(struct dgram);
+	struct dgram hdr [UDP_BATCH];
+	struct iovec iov [UDP_BATCH][2];
+	struct mmsghdr out [UDP_BATCH];
+	struct iovec iniov [UDP_BATCH];
+	char* pool = NULL;
+	struct mmsghdr* in = echo? udp_rxinit(&pool, iniov, NULL): NULL;
+	char* gen = keyed? (char*)malloc(UDP_BATCH * plen): NULL;
+	struct seqstats* st = echo? (struct seqstats*)calloc(1, sizeof(struct seqstats)): NULL;
+	long long count = datasize? (datasize + dgsize - 1) / dgsize: 0; // datagrams
+	long long pktns = udprate? 8e9 * dgsize / udprate: 0;
+	long long seq = 0, isent = 0, end = 0;
+	struct pollfd pollfd [2] = { { .fd = sock, }, { .fd = statfd, .events = POLLIN, }, };
+	
+	if ((keyed && !gen) || (echo && !st))
+	{
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	setcntl(sock, F_SETFL, O_NONBLOCK, "O_NONBLOCK");
+	udp_bufsize(sock);
+	
+	for (int i = 0; i < UDP_BATCH; i++)
+	{
+		iov[i][0] = (struct iovec){ .iov_base = &hdr[i], .iov_len = sizeof(hdr[i]), };
+		iov[i][1].iov_len = plen;
+		out[i].msg_hdr = (struct msghdr){ .msg_iov = iov[i], .msg_iovlen = 2, };
+	}
+	
+	tb = ti = nowns();
+	
+	while (1)
+	{
+		long long now = nowns();
+		long long due = count? count: LLONG_MAX;
+		int blocked = 0;
+		
+		if (pktns && (now - tb) / pktns + 1 < due)
+			due = (now - tb) / pktns + 1;
+		int n = due - seq > UDP_BATCH? UDP_BATCH: due - seq;
+		if (n > 0)
+		{
+			for (int i = 0; i < n; i++)
+			{
+				uint64_t s = seq + i;
+				hdr[i].seq = htobe64(s);
+				hdr[i].t = htobe64(now);
+				if (keyed)
+				{
+					iov[i][1].iov_base = gen + i * plen;
+					pattern_fill(gen + i * plen, s * plen, plen);
+				}
+				else
+					// bufout holds the pattern twice
+					iov[i][1].iov_base = bufout + (s & (buflen - 1));
+			}
+			int ret = sendmmsg(sock, out, n, MSG_DONTWAIT);
+			if (ret == -1)
+			{
+				// no responder yet (ICMP), or full queues
+				if (errno != EAGAIN && errno != ENOBUFS && errno != ECONNREFUSED)
+				{
+					perror("sendmmsg");
+					break;
+				}
+				ret = 0;
+			}
+			blocked = ret < n;
+			seq += ret;
+			isent += ret;
+			if (!echo)
+			{
+				data_in_loop += ret * (long long)dgsize;
+				data_overall += ret * (long long)dgsize;
+			}
+		}
+		
+		// done sending, echoes have one more second
+		if (count && seq >= count && !end)
+			end = echo? now + 1000000000LL: now;
+		if (end && now >= end)
+			break;
+		
+		long long wait = -1;
+		if (!blocked && pktns && seq < (count? count: LLONG_MAX))
+			wait = tb + seq * pktns - now;
+		else if (!blocked && !end)
+			wait = 0; // unlimited rate
+		if (end && (wait < 0 || end - now < wait))
+			wait = end - now;
+		struct timespec ts = { .tv_sec = wait / 1000000000LL, .tv_nsec = wait % 1000000000LL, };
+		pollfd[0].events = (echo? POLLIN: 0) | (blocked? POLLOUT: 0);
+		if (ppoll(pollfd, 2, wait < 0? NULL: &ts, NULL) == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("ppoll");
+			exit(EXIT_FAILURE);
+		}
+		
+		if (echo && (pollfd[0].revents & (POLLIN | POLLERR)))
+		{
+			int ret;
+			do
+			{
+				ret = recvmmsg(sock, in, UDP_BATCH, MSG_DONTWAIT, NULL);
+				if (ret == -1 && errno != EAGAIN && errno != ECONNREFUSED)
+				{
+					perror("recvmmsg");
+					exit(EXIT_FAILURE);
+				}
+				now = nowns();
+				for (int i = 0; i < ret; i++)
+					seq_account(st, NULL, iniov[i].iov_base, in[i].msg_len, in[i].msg_hdr.msg_flags & MSG_TRUNC, now, 1);
+			} while (ret == UDP_BATCH);
+		}
+		
+		if ((pollfd[1].revents & POLLIN) && stat_tick())
+		{
+			udp_show(st, isent, seq);
+			isent = 0;
+		}
+	}
+	
+	// the last line covers the whole run, the last interval can be empty
+	// (the wait for late echoes, not in the rates)
+	te = nowns();
+	if (output == OUTPUT_TEXT)
+	{
+		if (end && echo)
+			te = end - 1000000000LL;
+		ti = tb;
+		data_in_loop = data_overall;
+		lat_interval = lat_overall;
+		if (st)
+		{
+			st->ipackets = st->received + st->dups + st->bad;
+			st->iexpected = st->ireceived = 0;
+		}
+		udp_show(st, seq, seq);
+	}
+	udp_summary(st, seq);
+	free(st);
+	free(gen);
+	free(pool);
+	my_close(sock, 0);
+}
+
+// responder (echo to each sender) and sink
+void udp_receiver (int sock, int echo)
+{
+	struct iovec iov [UDP_BATCH];
+	struct sockaddr_in names [UDP_BATCH];
+	char* pool;
+	struct mmsghdr* msgs = udp_rxinit(&pool, iov, names);
+	struct seqstats* st = echo? NULL: (struct seqstats*)calloc(1, sizeof(struct seqstats));
+	struct pollfd pollfd [2] = { { .fd = sock, .events = POLLIN, }, { .fd = statfd, .events = POLLIN, }, };
+	long long echoed = 0, iechoed = 0, dropped = 0;
+	
+	if (!echo && !st)
+	{
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	udp_bufsize(sock);
+	
+	tb = ti = nowns();
+	
+	while (1)
+	{
+		if (poll(pollfd, 2, 1000 /*ms*/) == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			exit(EXIT_FAILURE);
+		}
+		
+		if (pollfd[0].revents & POLLIN)
+		{
+			int ret;
+			do
+			{
+				for (int i = 0; i < UDP_BATCH; i++)
+				{
+					iov[i].iov_len = dgsize;
+					msgs[i].msg_hdr.msg_namelen = sizeof(names[i]);
+				}
+				ret = recvmmsg(sock, msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+				if (ret == -1 && errno != EAGAIN)
+				{
+					perror("recvmmsg");
+					exit(EXIT_FAILURE);
+				}
+				if (ret <= 0)
+					break;
+				
+				if (!echo)
+				{
+					long long now = nowns();
+					for (int i = 0; i < ret; i++)
+						seq_account(st, &names[i], iov[i].iov_base, msgs[i].msg_len, msgs[i].msg_hdr.msg_flags & MSG_TRUNC, now, 0);
+					continue;
+				}
+				
+				// same buffers and addresses back, what does not fit is dropped
+				for (int i = 0; i < ret; i++)
+					iov[i].iov_len = msgs[i].msg_len;
+				int sent = sendmmsg(sock, msgs, ret, MSG_DONTWAIT);
+				if (sent == -1)
+				{
+					if (errno != EAGAIN && errno != ENOBUFS)
+					{
+						perror("sendmmsg");
+						exit(EXIT_FAILURE);
+					}
+					sent = 0;
+				}
+				dropped += ret - sent;
+				echoed += sent;
+				iechoed += sent;
+				for (int i = 0; i < sent; i++)
+				{
+					data_in_loop += msgs[i].msg_len;
+					data_overall += msgs[i].msg_len;
+				}
+			} while (ret == UDP_BATCH);
+		}
+		
+		if ((pollfd[1].revents & POLLIN) && stat_tick())
+		{
+			if (echo && output == OUTPUT_TEXT)
+			{
+				printf("\r[echoed:%g pps][dropped:%lli]", iechoed * 1e9 / (te - ti), dropped);
+				printbw(te - ti, data_in_loop, NULL);
+				printf("-----");
+				stat_endline();
+				data_in_loop = 0;
+				ti = te;
+			}
+			else if (echo)
+				udp_show(NULL, iechoed, echoed);
+			else
+				udp_show(st, 0, 0);
+			iechoed = 0;
+		}
+	}
+}
+
+// event-driven TCP server:
+// one epoll reactor per thread, each with its own (SO_REUSEPORT) listener,
+// every client gets its own session (ring, verification state, counters)
+
+struct serverconf
+{
+	int mode;
+	int port;
+	int nodelay;
+	int doflushinput;
+	int datasize;
+	ssize_t maxdiff;
+};
+
+struct session
+{
+	struct session* prev;
+	struct session* next;
+	int fd;
+	int id;
+	uint32_t events;
+	int flushing;
+	long long lastin; // ns
+	long long bytes;
+	struct stream cmp; // comparator, -k sink or source
+	struct ring r;     // responder
+	struct splicer sp; // zero-copy responder
+	struct replier rp; // -q n,m responder
+	struct zcrx z;     // zero-copy sink
+	int zcrx;          // z is mapped, otherwise the sink copies
+};
+
+struct reactor
+{
+	pthread_t thread;
+	int id;
+	int cpu; // -1: not pinned
+	int reuseport;
+	int report;
+	const struct serverconf* conf;
+	struct session* sessions;
+	int nflushing;
+	int nextid;
+	long long bytes; // written by reactor, read by main thread
+	char* bufin;
+	int tlsready [2]; // -t ktls: fds handshaken by tls_accept
+};
+
+static uint32_t session_events (const struct reactor* rc, const struct session* s)
+{
+	uint32_t events = 0;
+	
+	if (s->flushing)
+		return EPOLLIN;
+	
+	switch (rc->conf->mode)
+	{
+	case MODE_RESPONDER:
+		if (replying())
+		{
+			if (s->rp.toreply < buflen) events |= EPOLLIN;
+			if (s->rp.toreply) events |= EPOLLOUT;
+			break;
+		}
+		if (zerocopy)
+		{
+			if (s->sp.inpipe < s->sp.pipesz) events |= EPOLLIN;
+			if (s->sp.inpipe) events |= EPOLLOUT;
+			break;
+		}
+		if (ring_room(&s->r)) events |= EPOLLIN;
+		if (s->r.inbuf) events |= EPOLLOUT;
+		break;
+	case MODE_COMPARATOR:
+		events = EPOLLIN;
+		if (stream_wantout(&s->cmp) && (!s->cmp.datasize || s->cmp.total_sent < s->cmp.datasize))
+			events |= EPOLLOUT;
+		break;
+	case MODE_SINK:
+		events = EPOLLIN;
+		break;
+	case MODE_SOURCE:
+		events = EPOLLOUT;
+		break;
+	}
+	return events;
+}
+
+static void reactor_count (struct reactor* rc, struct session* s, ssize_t size)
+{
+	s->bytes += size;
+	__atomic_fetch_add(&rc->bytes, size, __ATOMIC_RELAXED);
+}
+
+// returns 0 when session is to be closed
+static int session_io (struct reactor* rc, struct session* s, uint32_t events)
+{
+	ssize_t ret;
+	
+	if (s->flushing)
+	{
+		ret = read(s->fd, rc->bufin, buflen);
+		if (ret == 0 || (ret == -1 && errno != EAGAIN))
+			return 0;
+		if (ret > 0)
+			s->lastin = nowns();
+		return 1;
+	}
+	
+	switch (rc->conf->mode)
+	{
+	case MODE_RESPONDER:
+		if (replying())
+		{
+			if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+			{
+				ret = replier_recv(s->fd, &s->rp, rc->bufin);
+				if (ret == 0 || (ret == -1 && errno != EAGAIN))
+					return 0;
+			}
+			if (events & EPOLLOUT)
 			{
-				fprintf(stderr, "peer has closed\n");
-				break;
+				ret = replier_send(s->fd, &s->rp);
+				if (ret == -1 && errno != EAGAIN)
+					return 0;
+				if (ret > 0)
+					reactor_count(rc, s, ret);
 			}
-			data_in_loop += ret;
-			data_overall += ret;
+			return 1;
+		}
+		if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+		{
+			ret = zerocopy? splicer_recv(s->fd, &s->sp): ring_recv(s->fd, &s->r);
+			if (ret == 0 || (ret == -1 && errno != EAGAIN))
+				return 0;
 		}
+		if (events & EPOLLOUT)
+		{
+			ret = zerocopy? splicer_send(s->fd, &s->sp): ring_send(s->fd, &s->r);
+			if (ret == -1 && errno != EAGAIN)
+				return 0;
+			if (ret > 0)
+				reactor_count(rc, s, ret);
+		}
+		return 1;
 		
-		if (pollfd.revents & ~(POLLIN | POLLOUT))
+	case MODE_COMPARATOR:
+		if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
 		{
-			fprintf(stderr, "unregular event occured\n");
-			break;
+			ret = stream_recv(&s->cmp, rc->bufin);
+			if (ret == 0 || (ret == -1 && errno != EAGAIN))
+				return 0;
+			if (ret > 0)
+				reactor_count(rc, s, ret);
 		}
+		if (events & EPOLLOUT)
+		{
+			ret = stream_send(&s->cmp);
+			if (ret == -1 && errno != EAGAIN)
+				return 0;
+		}
+		return stream_cont(&s->cmp);
+		
+	case MODE_SINK:
+		ret = s->zcrx? zcrx_recv(s->fd, &s->z, rc->bufin, buflen): read(s->fd, rc->bufin, buflen);
+		if (ret == 0 || (ret == -1 && errno != EAGAIN))
+			return 0;
+		if (ret > 0 && keyed)
+			stream_check(&s->cmp, rc->bufin, ret);
+		if (ret > 0)
+			reactor_count(rc, s, ret);
+		return 1;
 		
-		gettimeofday(&te, NULL);
-		showbw(0);
+	case MODE_SOURCE:
+		if (events & (EPOLLHUP | EPOLLERR))
+			return 0;
+		ret = write(s->fd, keyed? stream_txdata(&s->cmp, buflen): bufout, buflen);
+		if (ret == -1 && errno != EAGAIN)
+			return 0;
+		if (ret > 0)
+		{
+			s->cmp.total_sent += ret;
+			reactor_count(rc, s, ret);
+		}
+		return 1;
 	}
+	
+	return 0;
+}
 
-	my_close(sock);
+static void session_update (struct reactor* rc, int ep, struct session* s)
+{
+	uint32_t events = session_events(rc, s);
+	if (events != s->events)
+	{
+		struct epoll_event ev = { .events = events, .data.ptr = s, };
+		if (epoll_ctl(ep, EPOLL_CTL_MOD, s->fd, &ev) == -1)
+			perror("epoll_ctl");
+		s->events = events;
+	}
 }
 
-void echosource (int sock)
+// clisock is ready for the loop (TLS: the plain end)
+static void session_start (struct reactor* rc, int ep, int clisock)
 {
-	setcntl(sock, F_SETFL, O_NONBLOCK, "O_NONBLOCK");
+	const struct serverconf* conf = rc->conf;
+	
+	struct session* s = (struct session*)malloc(sizeof(struct session));
+	if (!s)
+	{
+		perror("malloc");
+		close(clisock);
+		return;
+	}
+	memset(s, 0, sizeof(struct session));
+	s->fd = clisock;
+	s->id = rc->nextid++;
+	if (conf->mode == MODE_RESPONDER && !replying() && zerocopy && !splicer_init(&s->sp))
+	{
+		close(clisock);
+		free(s);
+		return;
+	}
+	if (conf->mode == MODE_SINK && zerocopy)
+		s->zcrx = zcrx_init(&s->z, clisock);
+	if (conf->mode == MODE_RESPONDER && !replying() && !zerocopy)
+	{
+		int mirrored;
+		char* buf = ring_map(buflen, &mirrored);
+		ring_init(&s->r, buf, buflen, mirrored);
+	}
+	if (conf->mode == MODE_COMPARATOR || keyed)
+		stream_init(&s->cmp, clisock, s->id, conf->datasize, conf->maxdiff);
+	if (conf->doflushinput)
+	{
+		s->flushing = 1;
+		s->lastin = nowns();
+		rc->nflushing++;
+	}
 	
-	struct pollfd pollfd = { .fd = sock, .events = POLLOUT, };
+	s->events = session_events(rc, s);
+	struct epoll_event ev = { .events = s->events, .data.ptr = s, };
+	if (epoll_ctl(ep, EPOLL_CTL_ADD, clisock, &ev) == -1)
+	{
+		perror("epoll_ctl");
+		close(clisock);
+		free(s);
+		return;
+	}
 	
-	gettimeofday(&tb, NULL);
-	ti = tb;
+	s->next = rc->sessions;
+	if (s->next)
+		s->next->prev = s;
+	rc->sessions = s;
+	
+	printf("\n[%i.%i] remote client arrived.\n", rc->id, s->id);
+}
 
-	while (1)
+static void session_open (struct reactor* rc, int ep, int clisock)
+{
+	if (rc->conf->nodelay)
+		setflag(clisock, -1, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+#if TLS
+	if (transport == TRANSPORT_TLS && ktls)
 	{
-		int ret = poll(&pollfd, 1, 1000 /*ms*/);
-		if (ret == -1)
+		// back through tlsready
+		tls_accept(clisock, rc->tlsready[1]);
+		return;
+	}
+	if (transport == TRANSPORT_TLS && (clisock = tls_wrap(clisock, 1)) == -1)
+		return;
+#endif
+	session_start(rc, ep, clisock);
+}
+
+// both ways, s->bytes is one way (what is echoed, received or sent)
+static long long session_moved (struct reactor* rc, struct session* s)
+{
+	switch (rc->conf->mode)
+	{
+	case MODE_RESPONDER:
+		if (replying())
+			return s->bytes + (s->bytes + s->rp.toreply) / rr_resp * rr_req + s->rp.inreq;
+		return 2 * s->bytes + (zerocopy? s->sp.inpipe: s->r.inbuf);
+	case MODE_COMPARATOR:
+		return s->cmp.total_sent + s->cmp.total_recvd;
+	}
+	return s->bytes;
+}
+
+// a report line when bytes have moved since the last tick (or on a
+// snapshot), averages start with the first traffic
+static void server_show (long long bytes)
+{
+	if (bytes == data_overall && !stat_snapshot)
+	{
+		ti = te;
+		if (!bytes)
+			tb = te;
+		return;
+	}
+	data_in_loop += bytes - data_overall;
+	data_overall = bytes;
+	showbw(NULL, 0);
+}
+
+static void session_close (struct reactor* rc, int ep, struct session* s)
+{
+	printf("\n[%i.%i] closed, ", rc->id, s->id);
+	printsz(s->bytes, "size:");
+	printf("\n");
+	
+	if (s->flushing)
+		rc->nflushing--;
+	if (rc->conf->mode == MODE_RESPONDER && !replying() && zerocopy)
+		splicer_close(&s->sp);
+	if (rc->conf->mode == MODE_RESPONDER && !replying() && !zerocopy)
+		ring_unmap(s->r.buf, s->r.size, s->r.mirrored);
+	stream_free(&s->cmp);
+	if (s->zcrx)
+	{
+		printf("[%i.%i] ", rc->id, s->id);
+		zcrx_summary(&s->z);
+		zcrx_close(&s->z);
+	}
+	epoll_ctl(ep, EPOLL_CTL_DEL, s->fd, NULL);
+	my_close(s->fd, session_moved(rc, s));
+	if (s->prev)
+		s->prev->next = s->next;
+	else
+		rc->sessions = s->next;
+	if (s->next)
+		s->next->prev = s->prev;
+	free(s);
+}
+
+// input is flushed until nothing comes during 1s
+static void reactor_flushed (struct reactor* rc, int ep)
+{
+	long long now = nowns();
+	for (struct session* s = rc->sessions; s; s = s->next)
+		if (s->flushing && now - s->lastin > 1000000000LL)
 		{
-			perror("poll");
-			close(sock);
-			return;
+			s->flushing = 0;
+			rc->nflushing--;
+			session_update(rc, ep, s);
 		}
+}
 
-		if (pollfd.revents & POLLOUT)
+void* reactor_run (void* arg)
+{
+	struct reactor* rc = (struct reactor*)arg;
+	
+	if (rc->cpu >= 0)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(rc->cpu, &set);
+		int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if (err)
+			fprintf(stderr, "reactor #%i: pthread_setaffinity_np: %s\n", rc->id, strerror(err));
+	}
+	
+	if ((rc->bufin = (char*)malloc(buflen)) == NULL)
+	{
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	
+	int srvsock;
+	if (transport < TRANSPORT_UNIX)
+	{
+		srvsock = my_socket();
+		setflag(srvsock, -1, SOL_SOCKET, SO_REUSEADDR, 1, "SO_REUSEADDR");
+		if (rc->reuseport)
+			setflag(srvsock, -1, SOL_SOCKET, SO_REUSEPORT, 1, "SO_REUSEPORT");
+		my_bind_listen(srvsock, rc->conf->port, SOMAXCONN);
+	}
+	else
+	{
+		srvsock = my_unix_socket();
+		my_unix_bind_listen(srvsock, unixpath, SOMAXCONN);
+	}
+	setcntl(srvsock, F_SETFL, O_NONBLOCK, "O_NONBLOCK");
+	
+	int ep = epoll_create1(0);
+	if (ep == -1)
+	{
+		perror("epoll_create1");
+		exit(EXIT_FAILURE);
+	}
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL, };
+	if (epoll_ctl(ep, EPOLL_CTL_ADD, srvsock, &ev) == -1)
+	{
+		perror("epoll_ctl");
+		exit(EXIT_FAILURE);
+	}
+#if TLS
+	if (transport == TRANSPORT_TLS && ktls)
+	{
+		ev.data.ptr = rc->tlsready;
+		if (   pipe2(rc->tlsready, O_CLOEXEC | O_NONBLOCK) == -1
+		    || epoll_ctl(ep, EPOLL_CTL_ADD, rc->tlsready[0], &ev) == -1)
 		{
-			ssize_t ret = write(sock, bufout, BUFLEN);
-			if (ret == -1)
+			perror("tlsready");
+			exit(EXIT_FAILURE);
+		}
+	}
+#endif
+	// reporting reactor
+	ev.data.ptr = &statfd;
+	if (rc->report && statfd >= 0 && epoll_ctl(ep, EPOLL_CTL_ADD, statfd, &ev) == -1)
+	{
+		perror("epoll_ctl");
+		exit(EXIT_FAILURE);
+	}
+	
+	while (1)
+	{
+		struct epoll_event evs[256];
+		int nev = epoll_wait(ep, evs, sizeof(evs) / sizeof(evs[0]), 1000 /*ms*/);
+		if (nev == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			exit(EXIT_FAILURE);
+		}
+		
+		for (int e = 0; e < nev; e++)
+		{
+			struct session* s = (struct session*)evs[e].data.ptr;
+			
+			if (evs[e].data.ptr == &statfd)
 			{
-				perror("write");
-				break;
+				if (stat_tick())
+					server_show(rc->bytes);
+				continue;
 			}
-			if (ret == 0)
+			
+			if (evs[e].data.ptr == rc->tlsready)
 			{
-				fprintf(stderr, "peer has closed\n");
-				break;
+				int fd;
+				while (read(rc->tlsready[0], &fd, sizeof(fd)) == sizeof(fd))
+					session_start(rc, ep, fd);
+				continue;
 			}
-			data_in_loop += ret;
-			data_overall += ret;
+			
+			if (!s)
+			{
+				// listener
+				int clisock;
+				while ((clisock = accept4(srvsock, NULL, NULL, SOCK_NONBLOCK)) != -1)
+					session_open(rc, ep, clisock);
+				if (errno != EAGAIN)
+					perror("accept4()");
+				continue;
+			}
+			
+			if (!session_io(rc, s, evs[e].events))
+				session_close(rc, ep, s);
+			else
+				session_update(rc, ep, s);
 		}
 		
-		if (pollfd.revents & ~(POLLIN | POLLOUT))
+		if (rc->nflushing)
+			reactor_flushed(rc, ep);
+	}
+	
+	return NULL;
+}
+
+void server (const struct serverconf* conf, int nthreads, int pin)
+{
+	// a leaving client must not kill the server
+	signal(SIGPIPE, SIG_IGN);
+	
+	if (nthreads <= 1 && !pin)
+	{
+		// single reactor in main thread
+		struct reactor* rc = (struct reactor*)calloc(1, sizeof(struct reactor));
+		if (!rc)
 		{
-			fprintf(stderr, "unregular event occured\n");
-			break;
+			perror("calloc");
+			exit(EXIT_FAILURE);
+		}
+		rc->cpu = -1;
+		rc->report = 1;
+		rc->conf = conf;
+		if (transport < TRANSPORT_UNIX)
+			printf("waiting on port %i\n", conf->port);
+		else
+			printf("waiting on %s\n", unixpath);
+		tb = ti = nowns();
+		reactor_run(rc);
+		return;
+	}
+	
+	if (nthreads < 1)
+		nthreads = 1;
+	struct reactor* reactors = (struct reactor*)calloc(nthreads, sizeof(struct reactor));
+	if (!reactors)
+	{
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	
+	cpu_set_t cpus;
+	int ncpus = 0;
+	if (pin)
+	{
+		if (sched_getaffinity(0, sizeof(cpus), &cpus) == -1)
+		{
+			perror("sched_getaffinity");
+			exit(EXIT_FAILURE);
+		}
+		ncpus = CPU_COUNT(&cpus);
+	}
+	
+	for (int i = 0, cpu = 0; i < nthreads; i++)
+	{
+		reactors[i].id = i;
+		reactors[i].cpu = -1;
+		reactors[i].reuseport = 1;
+		reactors[i].conf = conf;
+		if (pin)
+		{
+			// next allowed cpu, round robin
+			int n = (i % ncpus) + 1;
+			for (cpu = 0; n; cpu++)
+				if (CPU_ISSET(cpu, &cpus))
+					n--;
+			reactors[i].cpu = cpu - 1;
+		}
+		int err = pthread_create(&reactors[i].thread, NULL, reactor_run, &reactors[i]);
+		if (err)
+		{
+			fprintf(stderr, "pthread_create: %s\n", strerror(err));
+			exit(EXIT_FAILURE);
+		}
+	}
+	printf("%i threads waiting on port %i\n", nthreads, conf->port);
+	
+	// aggregate counters
+	struct pollfd pollfd = { .fd = statfd, .events = POLLIN, };
+	tb = ti = nowns();
+	while (1)
+	{
+		if (poll(&pollfd, 1, -1) == -1 && errno != EINTR)
+		{
+			perror("poll");
+			exit(EXIT_FAILURE);
 		}
+		if (!stat_tick())
+			continue;
+		long long bytes = 0;
+		for (int i = 0; i < nthreads; i++)
+			bytes += __atomic_load_n(&reactors[i].bytes, __ATOMIC_RELAXED);
+		server_show(bytes);
+	}
+}
+
+// any baud rate: termios2 with BOTHER (asm/termbits.h clashes with termios.h,
+// this is its generic layout)
+struct serial_termios2
+{
+	tcflag_t c_iflag;
+	tcflag_t c_oflag;
+	tcflag_t c_cflag;
+	tcflag_t c_lflag;
+	cc_t c_line;
+	cc_t c_cc [19];
+	speed_t c_ispeed;
+	speed_t c_ospeed;
+};
+#define SERIAL_BOTHER 0010000
+#define SERIAL_IBSHIFT 16
+#define SERIAL_TCGETS2 _IOR('T', 0x2A, struct serial_termios2)
+#define SERIAL_TCSETS2 _IOW('T', 0x2B, struct serial_termios2)
+
+int serial_lowlatency = 0;     // -u: ASYNC_LOW_LATENCY
+int serial_latencytimer = -1;  // -U ms: USB-serial latency timer
+
+// returns the rate applied by the driver, or -1
+// rates known by termios
+static const struct { int baud; speed_t b; } serial_speeds [] =
+{
+	{ 1000000, B1000000 }, { 921600, B921600 }, { 576000, B576000 }, { 500000, B500000 },
+	{ 460800, B460800 }, { 230400, B230400 }, { 115200, B115200 }, { 57600, B57600 },
+	{ 38400, B38400 }, { 19200, B19200 }, { 9600, B9600 }, { 4800, B4800 }, { 2400, B2400 },
+};
 
-		gettimeofday(&te, NULL);
-		showbw(0);
+static int serial_setbaud (int fd, int baud)
+{
+	struct serial_termios2 tio2;
+	
+	if (ioctl(fd, SERIAL_TCGETS2, &tio2) == -1)
+	{
+		fprintf(stderr, "serial/TCGETS2: %s\n", strerror(errno));
+		return -1;
+	}
+	tio2.c_cflag &= ~(CBAUD | (CBAUD << SERIAL_IBSHIFT));
+	tio2.c_cflag |= SERIAL_BOTHER | (SERIAL_BOTHER << SERIAL_IBSHIFT);
+	tio2.c_ispeed = tio2.c_ospeed = baud;
+	if (ioctl(fd, SERIAL_TCSETS2, &tio2) == -1 || ioctl(fd, SERIAL_TCGETS2, &tio2) == -1)
+	{
+		fprintf(stderr, "serial/TCSETS2(%i): %s\n", baud, strerror(errno));
+		return -1;
 	}
+	return tio2.c_ospeed;
+}
 
-	my_close(sock);
+// best effort, failures are reported
+static void serial_lowlat (int fd, const char* dev)
+{
+	if (serial_lowlatency)
+	{
+		struct serial_struct ss;
+		if (ioctl(fd, TIOCGSERIAL, &ss) == -1)
+			fprintf(stderr, "serial/TIOCGSERIAL: %s\n", strerror(errno));
+		else
+		{
+			ss.flags |= ASYNC_LOW_LATENCY;
+			if (ioctl(fd, TIOCSSERIAL, &ss) == -1)
+				fprintf(stderr, "serial/TIOCSSERIAL(low latency): %s\n", strerror(errno));
+		}
+	}
+	
+	if (serial_latencytimer >= 0)
+	{
+		// ftdi_sio and others: /sys/class/tty/ttyUSB0/device/latency_timer
+		char path [PATH_MAX];
+		char* real = realpath(dev, NULL);
+		const char* base = strrchr(real?: dev, '/');
+		snprintf(path, sizeof(path), "/sys/class/tty/%s/device/latency_timer", base? base + 1: dev);
+		free(real);
+		FILE* f = fopen(path, "r+");
+		int ms = -1;
+		if (!f || fprintf(f, "%i\n", serial_latencytimer) < 0 || fflush(f) || fseek(f, 0, SEEK_SET) || fscanf(f, "%i", &ms) != 1)
+			fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		else
+			fprintf(stderr, "serial latency timer: %i ms\n", ms);
+		if (f)
+			fclose(f);
+	}
 }
 
 int serial_open (const char* dev, int baud, const char* mode, int verbose)
@@ -633,27 +4929,20 @@ int serial_open (const char* dev, int baud, const char* mode, int verbose)
 	tio.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
 	tio.c_oflag &= ~(OPOST | ONLCR);// linux don't know that: | OXTABS | ONOEOT);
 
-	/* fetch bytes as they become available */
-	tio.c_cc[VMIN] = 0;
+	/* fetch bytes as they become available, or -V batches */
+	tio.c_cc[VMIN] = serial_vmin;
 	tio.c_cc[VTIME] = 0;
 
-	speed_t b = 0;
-	switch (baud)
-	{
-	case 1000000: b = B1000000; break;
-	case 921600: b = B921600; break;
-	case 576000: b = B576000; break;
-	case 500000: b = B500000; break;
-	case 460800: b = B460800; break;
-	case 230400: b = B230400; break;
-	case 115200: b = B115200; break;
-	case 57600: b = B57600; break;
-	case 38400: b = B38400; break;
-	case 19200: b = B19200; break;
-	case 9600: b = B9600; break;
-	case 4800: b = B4800; break;
-	case 2400: b = B2400; break;
-	default:
+	speed_t b = B38400; // other rates: termios2 below
+	int standard = 0;
+	for (size_t i = 0; i < sizeof(serial_speeds) / sizeof(serial_speeds[0]); i++)
+		if (serial_speeds[i].baud == baud)
+		{
+			b = serial_speeds[i].b;
+			standard = 1;
+		}
+	if (baud <= 0)
+	{
 		fprintf(stderr, "invalid serial speed '%d'\n", baud);
 		close(fd);
 		return -1;
@@ -704,6 +4993,19 @@ int serial_open (const char* dev, int baud, const char* mode, int verbose)
 		close(fd); 
 		return -1;
 	}
+	
+	// flow control: none, r: RTS/CTS, x: XON/XOFF
+	tio.c_iflag &= ~(IXOFF | IXANY);
+	switch (tolower(mode[3]))
+	{
+	case 0: break;
+	case 'r': tio.c_cflag |= CRTSCTS; break;
+	case 'x': tio.c_iflag |= IXON | IXOFF; break;
+	default:
+		fprintf(stderr, "invalid serial flow control '%c' in '%s'\n", mode[3], mode);
+		close(fd);
+		return -1;
+	}
 		
 #if 0
 	tio.c_iflag = IGNPAR;
@@ -728,14 +5030,110 @@ int serial_open (const char* dev, int baud, const char* mode, int verbose)
 		close(fd);
 		return -1;
 	}
-		
-	return fd;
+	
+	// rate as applied by the driver (standard rates too)
+	int applied = serial_setbaud(fd, baud);
+	if (applied == -1 && standard)
+	{
+		// no termios2 (or another layout), termios has set it
+		applied = baud;
+		if (tcgetattr(fd, &tio) == 0)
+			for (size_t i = 0; i < sizeof(serial_speeds) / sizeof(serial_speeds[0]); i++)
+				if (serial_speeds[i].b == cfgetospeed(&tio))
+					applied = serial_speeds[i].baud;
+		fprintf(stderr, "serial speed: using termios\n");
+	}
+	if (applied == -1)
+	{
+		close(fd);
+		return -1;
+	}
+	if (verbose || applied != baud)
+		fprintf(stderr, "serial speed: %i applied (asked %i)\n", applied, baud);
+	
+	// start, data, parity and stop bits per char
+	int frame = 1 + (mode[0] - '0') + (tolower(mode[1]) == 'e' || tolower(mode[1]) == 'o') + (mode[2] - '0');
+	serial_cps = (double)applied / frame;
+	if (verbose)
+		fprintf(stderr, "serial line: %i bits per char, %g chars/s\n", frame, serial_cps);
+	
+	serial_lowlat(fd, dev);
+	
+	return fd;
+}
+
+// self-contained runs: a child is the responder (or the sink) on fd,
+// other is closed in the child
+pid_t peer_fork (int fd, int other, int responder)
+{
+	pid_t pid = fork();
+	if (pid == -1)
+	{
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+	if (pid)
+		return pid;
+	
+	// leaves with the parent, quiet, statistics are the parent's,
+	// own receive ring (bufin is shared)
+	prctl(PR_SET_PDEATHSIG, SIGTERM);
+	if (other >= 0)
+		close(other);
+	close(statfd);
+	statfd = -1;
+	bufin = ring_map(buflen, &bufin_mirrored);
+	int null = open("/dev/null", O_WRONLY);
+	if (null != -1)
+		dup2(null, STDOUT_FILENO);
+	if (responder)
+		echoresponder(fd);
+	else
+		echosink(fd);
+	exit(EXIT_SUCCESS);
+}
+
+// -y pty: new pty, *tty is set to the slave's name, returns the master
+int pty_open (const char** tty)
+{
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master == -1 || grantpt(master) == -1 || unlockpt(master) == -1)
+	{
+		perror("posix_openpt");
+		return -1;
+	}
+	*tty = strdup(ptsname(master));
+	return master;
+}
+
+// end of client runs
+void client_summary (int crr)
+{
+#if TLS
+	tls_summary();
+#endif
+	if (output != OUTPUT_TEXT)
+	{
+		if (!crr)
+			stat_summary();
+	}
+	else
+	{
+		if (zcstats.sends)
+			zc_summary();
+		if (rr_trans)
+			rr_summary();
+		else if (lat_overall.count)
+			lat_summary();
+	}
 }
 
 int main (int argc, char* argv[])
 {
 	int op;
 	const char* host = NULL;
+	const char* srclist = NULL;
+	char hostlist [1024];
 	const char* tty = NULL;
 	int ttyspeed = 115200;
 	const char* ttymode = "8n1";
@@ -751,13 +5149,18 @@ int main (int argc, char* argv[])
 	int nodelay = 0;
 	int doflushinput = 0;
 	int repeat = 0;
+	int parallel = 0;
+	int threads = 0;
+	int pin = 0;
+	int crr = 0;
+	long long crrcount = 0;
 	ssize_t maxdiff = 0;
 	
 	struct timeval t;
 	gettimeofday(&t, NULL);
 	srandom(t.tv_sec + t.tv_usec);
 
-	while ((op = getopt(argc, argv, "hp:d:fRc:s:Cy:b:m:nfw:rKSM:")) != EOF) switch(op)
+	while ((op = getopt(argc, argv, "hp:d:fRc:s:Cy:b:m:nfw:rKSM:P:T:Je:zl:HLq:x:o:k:t:g:B:i:X:uU:V:")) != EOF) switch(op)
 	{
 		case 'h':
 			help();
@@ -768,7 +5171,22 @@ int main (int argc, char* argv[])
 			break;
 			
 		case 'd':
-			host = optarg;
+			// several -d add up
+			if (host)
+			{
+				snprintf(hostlist, sizeof(hostlist), "%s,%s", host, optarg);
+				optarg = hostlist;
+			}
+			host = strdup(optarg);
+			break;
+		
+		case 'i':
+			if (srclist)
+			{
+				snprintf(hostlist, sizeof(hostlist), "%s,%s", srclist, optarg);
+				optarg = hostlist;
+			}
+			srclist = strdup(optarg);
 			break;
 		
 		case 'n':
@@ -797,6 +5215,11 @@ int main (int argc, char* argv[])
 		
 		case 'c':
 			userchar = atoi(optarg);
+			if (userchar == -3 && !keyed)
+			{
+				keyed = 1;
+				pattern_key = random();
+			}
 			break;
 		
 		case 's':
@@ -827,12 +5250,200 @@ int main (int argc, char* argv[])
 			method = optarg;
 			break;
 		
+#if TLS
+		case 'X':
+			tls_cert = optarg;
+			break;
+#endif
+		
+		case 'u':
+			serial_lowlatency = 1;
+			break;
+		
+		case 'U':
+			serial_latencytimer = atoi(optarg);
+			break;
+		
+		case 'V':
+			serial_vmin = atoi(optarg);
+			if (strchr(optarg, ','))
+				serial_vms = atoi(strchr(optarg, ',') + 1);
+			if (serial_vmin < 1 || serial_vmin > 255 || serial_vms < 1)
+			{
+				fprintf(stderr, "-V: min in 1..255, ms > 0\n");
+				return 1;
+			}
+			break;
+		
+		case 'P':
+			parallel = atoi(optarg);
+			break;
+		
+		case 'T':
+			threads = atoi(optarg);
+			break;
+		
+		case 'J':
+			pin = 1;
+			break;
+		
+		case 'z':
+			zerocopy = 1;
+			break;
+		
+		case 'l':
+		{
+			long long size = parsesize(optarg);
+			if (size < 1 || size > (1<<30))
+			{
+				fprintf(stderr, "invalid buffer size '%s'\n", optarg);
+				return 1;
+			}
+			for (buflen = 1; buflen < size; buflen <<= 1);
+			if (buflen != size)
+				fprintf(stderr, "buffer size rounded to %i\n", buflen);
+			break;
+		}
+		
+		case 'H':
+			hugepages = 1;
+			break;
+		
+		case 'k':
+			keyed = 1;
+			pattern_key = strtoul(optarg, NULL, 0);
+			break;
+		
+		case 'o':
+			if (strcmp(optarg, "json") == 0)
+				output = OUTPUT_JSON;
+			else if (strcmp(optarg, "csv") == 0)
+				output = OUTPUT_CSV;
+			else if (strcmp(optarg, "text") == 0)
+				output = OUTPUT_TEXT;
+			else
+			{
+				fprintf(stderr, "output: text, json or csv\n");
+				return 1;
+			}
+			break;
+		
+		case 'x':
+			crr = 1;
+			crrcount = atoll(optarg);
+			break;
+		
+		case 'q':
+		{
+			char* comma;
+			rr_req = rr_resp = parsesize(optarg);
+			if ((comma = strchr(optarg, ',')))
+				rr_resp = parsesize(comma + 1);
+			if (rr_req < 1 || rr_resp < 1)
+			{
+				fprintf(stderr, "invalid request/response sizes '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		}
+		
+		case 'L':
+			latency = 1;
+			break;
+		
+		case 't':
+		{
+			// kind[:path]
+			char* colon = strchr(optarg, ':');
+			if (colon)
+			{
+				*colon = 0;
+				unixpath = colon + 1;
+			}
+			if (strcmp(optarg, "tcp") == 0)
+				transport = TRANSPORT_TCP;
+			else if (strcmp(optarg, "udp") == 0)
+				transport = TRANSPORT_UDP;
+#if TLS
+			else if (strcmp(optarg, "tls") == 0)
+				transport = TRANSPORT_TLS;
+			else if (strcmp(optarg, "ktls") == 0)
+			{
+				transport = TRANSPORT_TLS;
+				ktls = 1;
+			}
+#endif
+			else if (strcmp(optarg, "unix") == 0)
+				transport = TRANSPORT_UNIX;
+			else if (strcmp(optarg, "seqpacket") == 0)
+				transport = TRANSPORT_SEQPACKET;
+			else if (strcmp(optarg, "fifo") == 0)
+				transport = TRANSPORT_FIFO;
+			else if (strcmp(optarg, "pair") == 0)
+				transport = TRANSPORT_PAIR;
+			else if (strcmp(optarg, "pipe") == 0)
+				transport = TRANSPORT_PIPE;
+			else
+			{
+				fprintf(stderr, "unknown transport '%s'\n", optarg);
+				return 1;
+			}
+			if (!unixpath)
+				unixpath = transport == TRANSPORT_FIFO? "/tmp/tcpechotester.fifo": "/tmp/tcpechotester.sock";
+			break;
+		}
+		
+		case 'g':
+			dgsize = parsesize(optarg);
+			if (dgsize < (int)sizeof(struct dgram) || dgsize > 65507)
+			{
+				fprintf(stderr, "datagram size: %i..65507\n", (int)sizeof(struct dgram));
+				return 1;
+			}
+			break;
+		
+		case 'B':
+			udprate = parsesize(optarg);
+			break;
+		
+		case 'e':
+			if (strcmp(optarg, "poll") == 0)
+				engine = ENGINE_POLL;
+#if URING
+			else if (strcmp(optarg, "uring") == 0)
+				engine = ENGINE_URING;
+#endif
+			else
+			{
+				fprintf(stderr, "unknown backend '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		
 		default:
 			printf("option '%c' not recognized\n", op);
 			help();
 			return 1;
 	}
 	
+#if TLS
+	// in-process: -M is the protocol version
+	if (transport == TRANSPORT_TLS)
+	{
+		tls_version = method;
+		method = NULL;
+		tls_every = repeat;
+		tls_ticketwait = parallel > 1;
+		// splice() reads and writes records through kTLS (or the pump's
+		// socketpair), MSG_ZEROCOPY and TCP_ZEROCOPY_RECEIVE would not
+		if (tty || crr || (zerocopy && !(ktls && responder)))
+		{
+			fprintf(stderr, "-t tls: not with -y -x -z (-z: -t ktls responder)\n");
+			return 1;
+		}
+	}
+#endif
+
 	if (comparator + responder + sink + source > 1 || comparator + responder + sink + source == 0)
 	{
 		fprintf(stderr, "error: need one and only one of -R (responder) or -C (comparator) or -S (source) or -K (sink) option\n\n");
@@ -846,19 +5457,282 @@ int main (int argc, char* argv[])
 		return 1;
 	}
 
+	if (parallel && (!comparator || !host || method))
+	{
+		fprintf(stderr, "use -C & -d with -P (not with -M)\n");
+		return 1;
+	}
+
+	if ((threads || pin) && (host || tty))
+	{
+		fprintf(stderr, "-T/-J are TCP server options\n");
+		return 1;
+	}
+
+	if (zerocopy && (source || comparator) && !host)
+	{
+		fprintf(stderr, "-z with -S or -C needs -d\n");
+		return 1;
+	}
+
+	if (keyed && zerocopy)
+	{
+		fprintf(stderr, "-c -3/-k and -z conflict\n");
+		return 1;
+	}
+
+	// io_uring is in the client loops only, its sends are not MSG_ZEROCOPY
+	if (   engine == ENGINE_URING
+	    && (   transport == TRANSPORT_UDP
+	        || (transport < TRANSPORT_UNIX && !host && !tty)
+	        || (transport == TRANSPORT_UNIX && (responder || sink))))
+	{
+		fprintf(stderr, "-e uring is a TCP or unix client option (not with a server or -t udp)\n");
+		return 1;
+	}
+	if (engine == ENGINE_URING && zerocopy)
+	{
+		fprintf(stderr, "-e uring and -z conflict\n");
+		return 1;
+	}
+
+	if (latency && (!comparator || threads))
+	{
+		fprintf(stderr, "-L is a comparator option (not with -T)\n");
+		return 1;
+	}
+
+	if (crr && (!comparator || !host || method || repeat))
+	{
+		fprintf(stderr, "use -C & -d with -x (not with -M or -r)\n");
+		return 1;
+	}
+
+	if (rr_req && (sink || source || (comparator && ((parallel && !crr) || (!host && !tty && transport < TRANSPORT_UNIX)))))
+	{
+		fprintf(stderr, "-q is for a client comparator (not with -P) or a responder\n");
+		return 1;
+	}
+
+	if (transport == TRANSPORT_UDP)
+	{
+		if (tty || method || parallel || crr || rr_req || threads || pin || repeat || zerocopy || latency)
+		{
+			fprintf(stderr, "-t udp: not with -y -M -P -x -q -T -J -r -z -L\n");
+			return 1;
+		}
+		if (!host != (responder || sink))
+		{
+			fprintf(stderr, "-t udp: -R and -K are servers, -C and -S need -d\n");
+			return 1;
+		}
+		if (dgsize - (int)sizeof(struct dgram) > buflen)
+		{
+			fprintf(stderr, "-t udp: -g needs -l %i or more\n", dgsize - (int)sizeof(struct dgram));
+			return 1;
+		}
+	}
+
+	if (transport >= TRANSPORT_UNIX)
+	{
+		if (host || tty || method || parallel || crr || threads || pin || zerocopy || nodelay)
+		{
+			fprintf(stderr, "local transports: not with -d -y -M -P -x -T -J -z -n\n");
+			return 1;
+		}
+		if (engine == ENGINE_URING && transport != TRANSPORT_UNIX)
+		{
+			fprintf(stderr, "-e uring: tcp or unix transports\n");
+			return 1;
+		}
+		// one direction, or a forked peer
+		if (   (transport == TRANSPORT_FIFO && (responder || comparator))
+		    || (transport == TRANSPORT_PIPE && !source)
+		    || (transport == TRANSPORT_PAIR && (responder || sink)))
+		{
+			fprintf(stderr, "fifo: -S or -K, pipe: -S (forked -K), pair: -C or -S (forked -R or -K)\n");
+			return 1;
+		}
+	}
+
+	if (srclist && !host)
+	{
+		fprintf(stderr, "-i is a client option (with -d)\n");
+		return 1;
+	}
+
+	// -q measures its own latency
+	if (rr_req)
+		latency = 0;
+
+	if (host)
+		my_resolve(host, port, dests, &ndests);
+	if (srclist)
+		my_resolve(srclist, 0, srcs, &nsrcs);
+
+	// records keep stdout for themselves, human-readable text goes to stderr
+	stat_out = stdout;
+	if (output != OUTPUT_TEXT)
+	{
+		fflush(stdout);
+		int fd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+		if (fd == -1 || !(stat_out = fdopen(fd, "w")) || dup2(STDERR_FILENO, STDOUT_FILENO) == -1)
+		{
+			perror("stdout");
+			exit(EXIT_FAILURE);
+		}
+		setvbuf(stdout, NULL, _IOLBF, 0);
+	}
+	
+	stat_init();
+#if TLS
+	if (transport == TRANSPORT_TLS)
+		tls_init(!host);
+#endif
+	stat_mode = crr? "crr": (rr_req && comparator)? "rr": responder? "responder": comparator? "comparator": sink? "sink": "source";
+	if (transport == TRANSPORT_PAIR || transport == TRANSPORT_PIPE)
+		snprintf(stat_peer, sizeof(stat_peer), "%s", transport == TRANSPORT_PAIR? "socketpair": "pipe");
+	else if (transport >= TRANSPORT_UNIX)
+		snprintf(stat_peer, sizeof(stat_peer), "%s", unixpath);
+	else if (host && strpbrk(host, ",:"))
+		snprintf(stat_peer, sizeof(stat_peer), "%s", host);
+	else if (host)
+		snprintf(stat_peer, sizeof(stat_peer), "%s:%i", host, port);
+	else if (tty)
+		snprintf(stat_peer, sizeof(stat_peer), "%s", tty);
+	else
+		snprintf(stat_peer, sizeof(stat_peer), "*:%i", port);
+
+	if (tty && strcmp(tty, "pty") == 0 && (responder || sink))
+	{
+		fprintf(stderr, "-y pty: -C or -S with a forked -R or -K\n");
+		return 1;
+	}
+
+	if (serial_vmin && !tty && !method)
+	{
+		fprintf(stderr, "-V is for -y\n");
+		return 1;
+	}
+	serial_cpu = tty || method;
+	
+	// random or increasing data hits 0x11/0x13
+	if (tty && strlen(ttymode) > 3 && tolower(ttymode[3]) == 'x' && (comparator || source)
+	    && (userchar <= 0 || userchar == 0x11 || userchar == 0x13))
+	{
+		fprintf(stderr, "-m ...x (XON/XOFF): data must not contain 0x11/0x13, use -c n\n");
+		return 1;
+	}
+
 	if (method && tty)
 	{
 		fprintf(stderr, "error: -y and -M conflict\n");
 		exit(EXIT_FAILURE);
 	}
 
-	for (i = 0; i < BUFLEN; i++)
+	if (method && (!host || srclist || strchr(host, ',')))
+	{
+		fprintf(stderr, "-M: socat connects to one -d host (no -i)\n");
+		return 1;
+	}
+
+	if ((bufout = (char*)malloc(2 * (size_t)buflen)) == NULL)
+	{
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < buflen; i++)
 		switch (userchar)
 		{
 		case -1: bufout[i] = i; break;
 		case 0: bufout[i] = random() >> 23; break;
 		default: bufout[i] = userchar;
 		}
+	if (keyed)
+		// streams generate their own window, bufout holds the start
+		pattern_fill(bufout, 0, buflen);
+	memcpy(bufout + buflen, bufout, buflen);
+	bufin = ring_map(buflen, &bufin_mirrored);
+	
+	if (transport == TRANSPORT_UDP)
+	{
+		int sock = socket(AF_INET, SOCK_DGRAM, 0);
+		if (sock == -1)
+		{
+			perror("socket()");
+			exit(EXIT_FAILURE);
+		}
+		if (host)
+		{
+			my_connect(sock);
+			printf("udp, %i-byte datagrams\n", dgsize);
+			udp_sender(sock, comparator, datasize);
+		}
+		else
+		{
+			struct sockaddr_in server = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_ANY), };
+			if (bind(sock, (struct sockaddr*)&server, sizeof(server)) == -1)
+			{
+				perror("bind()");
+				exit(EXIT_FAILURE);
+			}
+			printf("waiting on udp port %i\n", port);
+			udp_receiver(sock, responder);
+		}
+		return 0;
+	}
+	
+	if (transport == TRANSPORT_PAIR || transport == TRANSPORT_PIPE)
+	{
+		// the peer (responder or sink) is a child on the other end
+		int fds [2];
+		if ((transport == TRANSPORT_PAIR? socketpair(AF_UNIX, SOCK_STREAM, 0, fds): pipe(fds)) == -1)
+		{
+			perror("socketpair/pipe");
+			exit(EXIT_FAILURE);
+		}
+		pid_t pid = peer_fork(fds[0], fds[1], comparator);
+		close(fds[0]);
+		printf("%s to child %i\n", stat_peer, (int)pid);
+		if (source)
+			echosource(fds[1]);
+		else if (rr_req)
+			echorr(fds[1], datasize);
+		else
+			echocomparator(fds[1], datasize, maxdiff);
+		waitpid(pid, NULL, 0);
+	}
+	else if (transport >= TRANSPORT_UNIX && (comparator || source))
+	{
+		int fd;
+		if (transport == TRANSPORT_FIFO)
+			fd = my_fifo_open(unixpath, O_WRONLY);
+		else
+		{
+			fd = my_unix_socket();
+			my_unix_connect(unixpath, fd);
+		}
+		if (source)
+			echosource(fd);
+		else
+		{
+			if (doflushinput && !flushinput(fd))
+				return 1;
+			if (rr_req)
+				echorr(fd, datasize);
+			else
+				echocomparator(fd, datasize, maxdiff);
+		}
+	}
+	else if (transport == TRANSPORT_FIFO)
+		echosink(my_fifo_open(unixpath, O_RDONLY));
+	
+	if (transport >= TRANSPORT_UNIX && (transport == TRANSPORT_FIFO || comparator || source))
+	{
+		fprintf(stderr, "\n");
+		client_summary(0);
+		return 0;
+	}
 	
 	if (method)
 	{
@@ -869,7 +5743,8 @@ int main (int argc, char* argv[])
 		tty = loctty;
 		sprintf(socat1, "pty,link=%s,unlink-close,wait-slave",
 			tty);
-		sprintf(socat2, "ssl:%s:%i,method=%s,verify=0,reuseaddr",
+		// the name as given: socat resolves it and may check it
+		snprintf(socat2, 1024, "ssl:%s:%i,method=%s,verify=0,reuseaddr",
 			host, port, method);
 				
 		int fd = -1;
@@ -897,18 +5772,26 @@ int main (int argc, char* argv[])
 			{
 				usleep(10000); // 10ms
 				if ((fd = serial_open(tty, ttyspeed, ttymode, fd == -1)) != -1)
+				{
+					serial_cps = 0; // pty
 					break;
+				}
 			} while (--try > 0);
 			if (fd == -1)
 				exit(EXIT_FAILURE);
 			if (doflushinput && !flushinput(fd))
 				exit(EXIT_FAILURE);
 
-			echocomparator(fd, datasize, maxdiff);
+			if (rr_req)
+				echorr(fd, datasize);
+			else
+				echocomparator(fd, datasize, maxdiff);
 			
 			// kill socat
 			kill(pid, SIGINT);
 		} while (repeat);
+		fprintf(stderr, "\n");
+		client_summary(0);
 
 		return 0;
 	}
@@ -921,10 +5804,26 @@ int main (int argc, char* argv[])
 			exit(EXIT_FAILURE);
 		}
 		
+		// -y pty: self-loopback, the peer is a child on the master side,
+		// the slave gets the same termios settings as a real device
+		int master = -1;
+		if (strcmp(tty, "pty") == 0 && (master = pty_open(&tty)) == -1)
+			exit(EXIT_FAILURE);
+		
 		int fd = serial_open(tty, ttyspeed, ttymode, 1);
 		if (fd == -1)
 			exit(EXIT_FAILURE);
 		
+		// the child keeps the slave open: no EIO on the master at the end
+		pid_t peer = -1;
+		if (master != -1)
+		{
+			serial_cps = 0; // no line
+			peer = peer_fork(master, -1, comparator);
+			close(master);
+			printf("%s to child %i\n", tty, (int)peer);
+		}
+		
 		if (sink)
 			echosink(fd);
 		else if (source)
@@ -935,9 +5834,19 @@ int main (int argc, char* argv[])
 		{
 			if (doflushinput && !flushinput(fd))
 				return 1;
-			echocomparator(fd, datasize, maxdiff);
+			if (rr_req)
+				echorr(fd, datasize);
+			else
+				echocomparator(fd, datasize, maxdiff);
 			fprintf(stderr, "\n");
 		}
+		
+		if (peer != -1)
+		{
+			kill(peer, SIGTERM);
+			waitpid(peer, NULL, 0);
+		}
+		client_summary(0);
 	}
 
 	
@@ -950,10 +5859,22 @@ int main (int argc, char* argv[])
 	
 		do
 		{
+			if (crr)
+			{
+				echocrr(parallel? parallel: 1, crrcount, nodelay);
+				continue;
+			}
+			
+			if (parallel)
+			{
+				echocomparator_parallel(parallel, datasize, maxdiff, nodelay, doflushinput);
+				continue;
+			}
+			
 			int sock = my_socket();
 			if (nodelay)
 				setflag(sock, -1, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
-			my_connect(host, port, sock);
+			sock = my_connect(sock);
 			if (sink)
 				echosink(sock);
 			else if (source)
@@ -964,36 +5885,27 @@ int main (int argc, char* argv[])
 			{
 				if (doflushinput && !flushinput(sock))
 					return 1;
-				echocomparator(sock, datasize, maxdiff);
+				if (rr_req)
+					echorr(sock, datasize);
+				else
+					echocomparator(sock, datasize, maxdiff);
 			}
 		} while (repeat);
 		fprintf(stderr, "\n");
+		client_summary(crr);
 	}
-	else
+	else if (!tty)
 	{
-		int sock = my_socket();
-		my_bind_listen(sock, port);
-		while (1)
+		struct serverconf conf =
 		{
-			printf("waiting on port %i\n", port);
-			int clisock = my_accept(sock);
-			if (nodelay)
-				setflag(clisock, -1, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");\
-			if (sink)
-				echosink(clisock);
-			else if (source)
-				echosource(clisock);
-			else if (responder)
-				echoresponder(clisock);
-			else // comparator
-			{
-				if (doflushinput && !flushinput(clisock))
-					return 1;
-				echocomparator(clisock, datasize, maxdiff);
-				fprintf(stderr, "\n");
-			}
-		}
-		close(sock);
+			.mode = responder? MODE_RESPONDER: comparator? MODE_COMPARATOR: sink? MODE_SINK: MODE_SOURCE,
+			.port = port,
+			.nodelay = nodelay,
+			.doflushinput = doflushinput,
+			.datasize = datasize,
+			.maxdiff = maxdiff,
+		};
+		server(&conf, threads, pin);
 	}
 	
 	return 0;